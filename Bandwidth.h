@@ -0,0 +1,225 @@
+/*
+ * Bandwidth.h
+ *
+ * Per-client message budgets and bounded receive queues
+ *
+ * A client may send at most outboundBudget messages in any simulated second.
+ * Sends beyond that are suppressed at the sender and never reach the network.
+ *
+ * A client handles at most inboundBudget messages a second, and up to
+ * queueCapacity more wait in its receive queue.  The queue is a leaky bucket:
+ * the backlog drains by inboundBudget every second, and a message arriving at
+ * a full queue overflows.  With RANDOM_EARLY_DROP, a message arriving at a
+ * queue more than half full is also dropped, with a probability that rises
+ * linearly to 1 as the queue fills, drawn from the recipient's stream.
+ * Handling is instantaneous in this model, so the queue decides admission
+ * but adds no delay.
+ *
+ * State is kept in dense arrays indexed by clientId, only for the budgets
+ * that are set.  A client's send state is only touched by the worker that
+ * owns its partition, and its receive state only by the worker delivering
+ * to that partition, so neither needs synchronization.
+ *
+ * Every client remembers when it first overflowed and how many times it has,
+ * so a run shows where and when fan-in saturates the most observed clients.
+ */
+
+#ifndef _BANDWIDTH_H_
+#define _BANDWIDTH_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "ClientTypes.h"
+#include "Checkpoint.h"
+
+class Bandwidth {
+
+ public:
+  // Returned by getFirstOverflow() while no client has overflowed
+  static const uint32_t NIL = 0xFFFFFFFF;
+
+  enum Admission {
+    ADMITTED,
+    OVERFLOWED,
+    EARLY_DROPPED
+  };
+
+  Bandwidth(const SimulatorConfig& config)
+    : inboundBudget_(config.inboundBudget),
+      outboundBudget_(config.outboundBudget),
+      queueCapacity_(config.queueCapacity),
+      dropPolicy_(config.dropPolicy)
+  {
+    if (outboundBudget_ != 0) {
+      sendSecond_.resize(config.nodeCount, 0);
+      sendCount_.resize(config.nodeCount, 0);
+    }
+
+    if (inboundBudget_ != 0) {
+      backlog_.resize(config.nodeCount, 0);
+      drained_.resize(config.nodeCount, 0);
+      firstOverflow_.resize(config.nodeCount, (uint32_t)NIL);
+      overflows_.resize(config.nodeCount, 0);
+    }
+  }
+
+  inline bool isLimited(void) const {
+    return inboundBudget_ != 0 || outboundBudget_ != 0;
+  }
+
+  inline bool isInboundLimited(void) const {
+    return inboundBudget_ != 0;
+  }
+
+  // Whether sender may send another message in second now
+  inline bool admitSend(const clientId_t& sender, const uint32_t& now) {
+
+    if (outboundBudget_ == 0) {
+      return true;
+    }
+
+    if (sendSecond_[sender] != now) {
+      sendSecond_[sender] = now;
+      sendCount_[sender] = 0;
+    }
+
+    return sendCount_[sender]++ < outboundBudget_;
+  }
+
+  // Queue a message arriving at recipient in second now.  random() is only
+  // called when random early drop needs a draw.
+  template<class Random>
+  inline Admission admitReceive(const clientId_t& recipient, const uint32_t& now, Random random) {
+
+    if (inboundBudget_ == 0) {
+      return ADMITTED;
+    }
+
+    // Drain whatever was handled since the last arrival
+    uint64_t handled = (uint64_t)(now - drained_[recipient]) * inboundBudget_;
+    uint32_t backlog = handled >= backlog_[recipient] ? 0 : backlog_[recipient] - (uint32_t)handled;
+    drained_[recipient] = now;
+
+    Admission admission = ADMITTED;
+
+    if (backlog >= inboundBudget_ + queueCapacity_) {
+      admission = OVERFLOWED;
+    } else if (dropPolicy_ == RANDOM_EARLY_DROP && backlog > inboundBudget_ + queueCapacity_ / 2) {
+
+      // Queued messages beyond half full, out of the half that remains
+      uint32_t excess = backlog - inboundBudget_ - queueCapacity_ / 2;
+
+      if (random() % (queueCapacity_ - queueCapacity_ / 2) < excess) {
+	admission = EARLY_DROPPED;
+      }
+    }
+
+    if (admission == ADMITTED) {
+      backlog++;
+    } else {
+      if (overflows_[recipient] == 0) {
+	firstOverflow_[recipient] = now;
+      }
+
+      overflows_[recipient]++;
+    }
+
+    backlog_[recipient] = backlog;
+    return admission;
+  }
+
+  // Clients whose queue has overflowed at least once
+  uint32_t getOverflowingClientCount(void) const {
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < overflows_.size(); i++) {
+      count += overflows_[i] != 0;
+    }
+
+    return count;
+  }
+
+  // Earliest overflow of any client, or NIL
+  uint32_t getFirstOverflow(void) const {
+    uint32_t first = NIL;
+
+    for (size_t i = 0; i < firstOverflow_.size(); i++) {
+      first = std::min(first, firstOverflow_[i]);
+    }
+
+    return first;
+  }
+
+  // The client that has overflowed most, lowest id on ties, or NIL
+  clientId_t getWorstClient(void) const {
+    clientId_t worst = NIL;
+
+    for (size_t i = 0; i < overflows_.size(); i++) {
+      if (overflows_[i] != 0 && (worst == NIL || overflows_[i] > overflows_[worst])) {
+	worst = i;
+      }
+    }
+
+    return worst;
+  }
+
+  inline uint32_t getOverflowCount(const clientId_t& clientId) const {
+    return overflows_[clientId];
+  }
+
+  void save(CheckpointWriter& writer) const {
+    writer.write(inboundBudget_);
+    writer.write(outboundBudget_);
+    writer.write(queueCapacity_);
+    writer.write((uint32_t)dropPolicy_);
+    writer.writeVector(sendSecond_);
+    writer.writeVector(sendCount_);
+    writer.writeVector(backlog_);
+    writer.writeVector(drained_);
+    writer.writeVector(firstOverflow_);
+    writer.writeVector(overflows_);
+  }
+
+  // Returns false if the checkpoint was taken with different limits
+  bool restore(CheckpointReader& reader) {
+    uint32_t limits[4] = { 0 };
+    reader.read(limits[0]);
+    reader.read(limits[1]);
+    reader.read(limits[2]);
+    reader.read(limits[3]);
+
+    if (limits[0] != inboundBudget_ || limits[1] != outboundBudget_
+	|| limits[2] != queueCapacity_ || limits[3] != (uint32_t)dropPolicy_) {
+      return false;
+    }
+
+    reader.readVector(sendSecond_);
+    reader.readVector(sendCount_);
+    reader.readVector(backlog_);
+    reader.readVector(drained_);
+    reader.readVector(firstOverflow_);
+    reader.readVector(overflows_);
+    return true;
+  }
+
+ private:
+  uint32_t inboundBudget_;
+  uint32_t outboundBudget_;
+  uint32_t queueCapacity_;
+  DropPolicy dropPolicy_;
+
+  // Indexed by clientId: the second of the client's latest send and its sends in it
+  std::vector<uint32_t> sendSecond_;
+  std::vector<uint32_t> sendCount_;
+
+  // Indexed by clientId: messages admitted but not yet handled as of drained_
+  std::vector<uint32_t> backlog_;
+  std::vector<uint32_t> drained_;
+
+  // Indexed by clientId
+  std::vector<uint32_t> firstOverflow_;
+  std::vector<uint32_t> overflows_;
+};
+
+#endif // _BANDWIDTH_H_
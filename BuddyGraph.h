@@ -0,0 +1,313 @@
+/*
+ * BuddyGraph.h
+ *
+ * Immutable buddy/observer graph in compressed sparse row form
+ *
+ * The graph is built in two steps.  allocate() sizes every client's buddy
+ * list, the lists are filled in place (in parallel, since each client's list
+ * is its own slice of the array), and freeze() then sorts each list, drops
+ * self edges and duplicates, and builds the reverse index of each client's
+ * observers.  Buddy edges are addressed by their offset into the buddy array,
+ * so per-edge data can live in parallel arrays.
+ *
+ * freeze() runs on a WorkerPool, each worker taking a contiguous range of
+ * clients.  The observer index is a counting sort in which every worker
+ * counts a disjoint run of the edges into its own histogram, and a prefix sum
+ * over (buddy, worker) gives each worker its own slots to scatter into, so no
+ * counter or cursor is shared and no atomics are needed.  Runs ascend by
+ * source client, which leaves every observer list sorted by id, whatever the
+ * number of workers.
+ *
+ * A frozen graph can also be attached to CSR arrays owned elsewhere, such as
+ * a memory mapped GraphFile.  Every accessor reads through the data pointers,
+ * which point either into the graph's own vectors or into those arrays.
+ */
+
+#ifndef _BUDDY_GRAPH_H_
+#define _BUDDY_GRAPH_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "ClientTypes.h"
+#include "WorkerPool.h"
+
+class BuddyGraph {
+
+ public:
+  BuddyGraph(const uint32_t& nodeCount)
+    : nodeCount_(nodeCount),
+      frozen_(false),
+      buddyOffsets_(nodeCount + 1, 0),
+      observerOffsets_(nodeCount + 1, 0)
+  {
+    publish();
+  }
+
+  // Make this a frozen view of CSR arrays owned by someone else, which must
+  // outlive the graph.  Offsets arrays hold nodeCount + 1 entries.
+  void attach(const uint32_t* buddyOffsets, const clientId_t* buddies,
+	      const uint32_t* observerOffsets, const clientId_t* observers) {
+
+    std::vector<uint32_t>().swap(buddyOffsets_);
+    std::vector<clientId_t>().swap(buddies_);
+    std::vector<uint32_t>().swap(observerOffsets_);
+    std::vector<clientId_t>().swap(observers_);
+
+    buddyOffsetData_ = buddyOffsets;
+    buddyData_ = buddies;
+    observerOffsetData_ = observerOffsets;
+    observerData_ = observers;
+    edgeCount_ = buddyOffsets[nodeCount_];
+
+    frozen_ = true;
+  }
+
+  // Size client i's buddy list to degrees[i]
+  void allocate(const std::vector<uint32_t>& degrees) {
+    for (uint32_t i = 0; i < nodeCount_; i++) {
+      buddyOffsets_[i + 1] = buddyOffsets_[i] + degrees[i];
+    }
+
+    buddies_.resize(buddyOffsets_[nodeCount_]);
+    publish();
+  }
+
+  // The allocated buddy list of clientId, to be filled before freeze()
+  inline clientId_t* getBuddySlots(const clientId_t& clientId) {
+    return &buddies_[buddyOffsets_[clientId]];
+  }
+
+  // Sort and compact the buddy lists and build the observer index
+  void freeze(WorkerPool& pool) {
+
+    uint32_t workerCount = pool.getThreadCount();
+
+    // Sort each buddy list and compact away self edges and duplicates in place
+    std::vector<uint32_t> degrees(nodeCount_);
+
+    pool.run([&](const uint32_t& worker) {
+	for (clientId_t i = rangeBegin(worker, workerCount); i != rangeBegin(worker + 1, workerCount); i++) {
+	  degrees[i] = compact(i);
+	}
+      });
+
+    // Close the gaps compaction left, if there are any
+    uint32_t edgeCount = 0;
+
+    for (uint32_t i = 0; i < nodeCount_; i++) {
+      edgeCount += degrees[i];
+    }
+
+    if (edgeCount != buddies_.size()) {
+
+      std::vector<clientId_t> buddies(edgeCount);
+      std::vector<uint32_t> offsets(nodeCount_ + 1, 0);
+
+      for (uint32_t i = 0; i < nodeCount_; i++) {
+	offsets[i + 1] = offsets[i] + degrees[i];
+      }
+
+      pool.run([&](const uint32_t& worker) {
+	  for (clientId_t i = rangeBegin(worker, workerCount); i != rangeBegin(worker + 1, workerCount); i++) {
+	    std::copy(buddies_.begin() + buddyOffsets_[i], buddies_.begin() + buddyOffsets_[i] + degrees[i], buddies.begin() + offsets[i]);
+	  }
+	});
+
+      buddies_.swap(buddies);
+      buddyOffsets_.swap(offsets);
+    }
+
+    // Counting sort the reverse edges into the observer index.  Each worker
+    // takes a disjoint run of source clients holding about edgeCount /
+    // workerCount edges, and counts its edges' buddies in its own histogram.
+    std::vector<clientId_t> sources(workerCount + 1, nodeCount_);
+    std::vector<std::vector<uint32_t> > cursors(workerCount);
+
+    for (uint32_t worker = 0; worker < workerCount; worker++) {
+      sources[worker] = std::lower_bound(buddyOffsets_.begin(), buddyOffsets_.end() - 1,
+					 (uint64_t)edgeCount * worker / workerCount) - buddyOffsets_.begin();
+    }
+
+    pool.run([&](const uint32_t& worker) {
+
+	std::vector<uint32_t>& counts = cursors[worker];
+	counts.assign(nodeCount_, 0);
+
+	for (uint32_t edge = buddyOffsets_[sources[worker]]; edge != buddyOffsets_[sources[worker + 1]]; edge++) {
+	  counts[buddies_[edge]]++;
+	}
+      });
+
+    // Prefix sum over (buddy, worker), turning each count into the worker's
+    // first slot in that buddy's list.  Workers hold ascending runs of
+    // sources, so every list comes out sorted by observer.
+    uint32_t slot = 0;
+
+    for (clientId_t i = 0; i < nodeCount_; i++) {
+      observerOffsets_[i] = slot;
+
+      for (uint32_t worker = 0; worker < workerCount; worker++) {
+	uint32_t count = cursors[worker][i];
+	cursors[worker][i] = slot;
+	slot += count;
+      }
+    }
+
+    observerOffsets_[nodeCount_] = slot;
+    observers_.resize(edgeCount);
+
+    pool.run([&](const uint32_t& worker) {
+
+	std::vector<uint32_t>& cursor = cursors[worker];
+
+	for (clientId_t i = sources[worker]; i != sources[worker + 1]; i++) {
+	  for (uint32_t edge = buddyOffsets_[i]; edge != buddyOffsets_[i + 1]; edge++) {
+	    observers_[cursor[buddies_[edge]]++] = i;
+	  }
+	}
+      });
+
+    publish();
+    frozen_ = true;
+  }
+
+  inline bool isFrozen(void) const {
+    return frozen_;
+  }
+
+  inline uint32_t getNodeCount(void) const {
+    return nodeCount_;
+  }
+
+  inline uint32_t getEdgeCount(void) const {
+    return edgeCount_;
+  }
+
+  // Buddy edges of a client are [getBuddyBegin(clientId), getBuddyEnd(clientId))
+  inline uint32_t getBuddyBegin(const clientId_t& clientId) const {
+    return buddyOffsetData_[clientId];
+  }
+
+  inline uint32_t getBuddyEnd(const clientId_t& clientId) const {
+    return buddyOffsetData_[clientId + 1];
+  }
+
+  inline uint32_t getBuddyCount(const clientId_t& clientId) const {
+    return buddyOffsetData_[clientId + 1] - buddyOffsetData_[clientId];
+  }
+
+  inline clientId_t getBuddy(const uint32_t& edge) const {
+    return buddyData_[edge];
+  }
+
+  // Every buddy edge's id, in edge order
+  inline const clientId_t* getBuddies(void) const {
+    return buddyData_;
+  }
+
+  // Edge index of buddyId in clientId's buddy list, or getBuddyEnd(clientId) if absent
+  inline uint32_t findBuddy(const clientId_t& clientId, const clientId_t& buddyId) const {
+    const clientId_t* begin = buddyData_ + buddyOffsetData_[clientId];
+    const clientId_t* end = buddyData_ + buddyOffsetData_[clientId + 1];
+    const clientId_t* i = std::lower_bound(begin, end, buddyId);
+
+    if (i == end || *i != buddyId) {
+      return buddyOffsetData_[clientId + 1];
+    }
+
+    return i - buddyData_;
+  }
+
+  // Observers of a client are [getObserverBegin(clientId), getObserverEnd(clientId))
+  inline uint32_t getObserverBegin(const clientId_t& clientId) const {
+    return observerOffsetData_[clientId];
+  }
+
+  inline uint32_t getObserverEnd(const clientId_t& clientId) const {
+    return observerOffsetData_[clientId + 1];
+  }
+
+  inline uint32_t getObserverCount(const clientId_t& clientId) const {
+    return observerOffsetData_[clientId + 1] - observerOffsetData_[clientId];
+  }
+
+  inline clientId_t getObserver(const uint32_t& index) const {
+    return observerData_[index];
+  }
+
+  // Hash of the buddy lists, which identifies the graph a checkpoint was taken on
+  uint64_t getFingerprint(void) const {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ nodeCount_;
+
+    for (uint32_t i = 0; i <= nodeCount_; i++) {
+      hash = (hash ^ buddyOffsetData_[i]) * 0x100000001b3ULL;
+    }
+
+    for (uint32_t edge = 0; edge < edgeCount_; edge++) {
+      hash = (hash ^ buddyData_[edge]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+  }
+
+  // The raw CSR arrays, for writing the graph out
+  inline const uint32_t* getBuddyOffsets(void) const {
+    return buddyOffsetData_;
+  }
+
+  inline const uint32_t* getObserverOffsets(void) const {
+    return observerOffsetData_;
+  }
+
+  inline const clientId_t* getObservers(void) const {
+    return observerData_;
+  }
+
+ private:
+
+  // Point the accessors at the graph's own vectors
+  void publish(void) {
+    buddyOffsetData_ = buddyOffsets_.data();
+    buddyData_ = buddies_.data();
+    observerOffsetData_ = observerOffsets_.data();
+    observerData_ = observers_.data();
+    edgeCount_ = buddies_.size();
+  }
+
+  // First client of worker's share of the population
+  inline clientId_t rangeBegin(const uint32_t& worker, const uint32_t& workerCount) const {
+    return (uint64_t)nodeCount_ * worker / workerCount;
+  }
+
+  // Sort clientId's buddy list and drop self edges and duplicates.  Returns the new length.
+  uint32_t compact(const clientId_t& clientId) {
+
+    std::vector<clientId_t>::iterator begin = buddies_.begin() + buddyOffsets_[clientId];
+    std::vector<clientId_t>::iterator end = buddies_.begin() + buddyOffsets_[clientId + 1];
+
+    std::sort(begin, end);
+    end = std::unique(begin, end);
+    end = std::remove(begin, end, clientId);
+
+    return end - begin;
+  }
+
+  uint32_t nodeCount_;
+  bool frozen_;
+
+  std::vector<uint32_t> buddyOffsets_;
+  std::vector<clientId_t> buddies_;
+
+  std::vector<uint32_t> observerOffsets_;
+  std::vector<clientId_t> observers_;
+
+  // What the accessors read: the vectors above, or attached arrays
+  const uint32_t* buddyOffsetData_;
+  const clientId_t* buddyData_;
+  const uint32_t* observerOffsetData_;
+  const clientId_t* observerData_;
+  uint32_t edgeCount_;
+};
+
+#endif // _BUDDY_GRAPH_H_
@@ -0,0 +1,177 @@
+/*
+ * CalendarQueue.h
+ *
+ * In-flight messages, bucketed by the simulated second they are delivered in
+ *
+ * A calendar queue with one bucket per second over a power-of-two ring that
+ * spans the longest link latency, so a message due at time t lives in bucket
+ * t mod the ring size and no two pending seconds share a bucket.  A bucket
+ * costs one slot index until a message is due in it, when it takes a
+ * MessageQueue from a pool, and releasing it sorts its messages into a
+ * worker's outboxes by destination partition and returns the queue to the
+ * pool.  Memory therefore follows the seconds with messages in flight, not
+ * the horizon, and once the pool has grown to the busiest stretch of seconds
+ * no further allocation takes place.  Finding the next due second scans the
+ * ring forward from the current time, which is paid for by the seconds the
+ * event loop skips.
+ */
+
+#ifndef _CALENDAR_QUEUE_H_
+#define _CALENDAR_QUEUE_H_
+
+#include <vector>
+
+#include "ClientTypes.h"
+#include "MessageQueue.h"
+
+class CalendarQueue {
+
+ public:
+  // Returned by next() when nothing is in flight
+  static const uint32_t NIL = 0xFFFFFFFF;
+
+  // A queue for messages up to horizon seconds in the future, for recipients
+  // partitioned partitionSize to a worker
+  CalendarQueue(const uint32_t& partitionSize, const uint32_t& horizon)
+    : partitionSize_(partitionSize),
+      bucketCount_(0),
+      size_(0)
+  {
+    if (horizon == 0) {
+      return;
+    }
+
+    bucketCount_ = 1;
+
+    while (bucketCount_ <= horizon) {
+      bucketCount_ *= 2;
+    }
+
+    slots_.resize(bucketCount_, (uint32_t)NIL);
+  }
+
+  // Longest delay from now a message can be pushed with
+  inline uint32_t getHorizon(void) const {
+    return bucketCount_ == 0 ? 0 : bucketCount_ - 1;
+  }
+
+  inline size_t size(void) const {
+    return size_;
+  }
+
+  inline void push(const uint32_t& deliveryTime, const ClientMessage& message) {
+
+    uint32_t& slot = slots_[deliveryTime & (bucketCount_ - 1)];
+
+    if (slot == NIL) {
+      if (free_.empty()) {
+	slot = queues_.size();
+	queues_.push_back(MessageQueue(16));
+      } else {
+	slot = free_.back();
+	free_.pop_back();
+      }
+    }
+
+    queues_[slot].push(message);
+    size_++;
+  }
+
+  // Move the messages due at time onto the end of outboxes, one per
+  // partition.  Returns how many there were.
+  size_t release(const uint32_t& time, std::vector<MessageQueue>& outboxes) {
+
+    if (size_ == 0) {
+      return 0;
+    }
+
+    uint32_t& slot = slots_[time & (bucketCount_ - 1)];
+
+    if (slot == NIL) {
+      return 0;
+    }
+
+    MessageQueue& due = queues_[slot];
+    size_t count = due.size();
+
+    for (; !due.empty(); due.pop()) {
+      outboxes[due.front().recipientId / partitionSize_].push(due.front());
+    }
+
+    free_.push_back(slot);
+    slot = NIL;
+    size_ -= count;
+    return count;
+  }
+
+  // The first second after "after" with messages due, or NIL
+  uint32_t next(const uint32_t& after) const {
+
+    if (size_ == 0) {
+      return NIL;
+    }
+
+    for (uint32_t delay = 1; delay < bucketCount_; delay++) {
+      if (slots_[(after + delay) & (bucketCount_ - 1)] != NIL) {
+	return after + delay;
+      }
+    }
+
+    return NIL;
+  }
+
+  // Call visitor(deliveryTime, message) for every message in flight, in
+  // delivery order, where "now" is the last second released
+  template<class Visitor>
+  void visit(const uint32_t& now, Visitor visitor) const {
+    for (uint32_t delay = 0; delay < bucketCount_ && size_ != 0; delay++) {
+
+      uint32_t slot = slots_[(now + delay) & (bucketCount_ - 1)];
+
+      if (slot == NIL) {
+	continue;
+      }
+
+      const MessageQueue& queue = queues_[slot];
+
+      for (size_t i = 0; i < queue.size(); i++) {
+	visitor(now + delay, queue.at(i));
+      }
+    }
+  }
+
+  // Call update(message) on every message in flight, in no particular order
+  template<class Update>
+  void update(Update update) {
+    for (size_t i = 0; i < queues_.size(); i++) {
+      for (size_t j = 0; j < queues_[i].size(); j++) {
+	update(queues_[i].at(j));
+      }
+    }
+  }
+
+  // Heap allocations made by the pooled queues
+  size_t getAllocationCount(void) const {
+    size_t count = 0;
+
+    for (size_t i = 0; i < queues_.size(); i++) {
+      count += queues_[i].getAllocationCount();
+    }
+
+    return count;
+  }
+
+ private:
+  uint32_t partitionSize_;
+  uint32_t bucketCount_;
+  size_t size_;
+
+  // Indexed by bucket: the queue in queues_ holding its messages, or NIL
+  std::vector<uint32_t> slots_;
+
+  // Queues in use by a bucket or free for the next one to need one
+  std::vector<MessageQueue> queues_;
+  std::vector<uint32_t> free_;
+};
+
+#endif // _CALENDAR_QUEUE_H_
@@ -0,0 +1,224 @@
+/*
+ * Checkpoint.h
+ *
+ * Streaming binary snapshots of a running simulator
+ *
+ * A checkpoint is a fixed header describing the run (protocol, population,
+ * seed, topology, the simulated time reached and a fingerprint of the buddy
+ * graph), followed by each component's state in a fixed order.  Components
+ * write themselves with save(CheckpointWriter&) and read themselves back with
+ * restore(CheckpointReader&), as plain values and length-prefixed arrays in
+ * host byte order.
+ *
+ * The buddy graph itself is not stored.  A restored run rebuilds it from the
+ * header's seed and topology, or maps it from a graph file, and the
+ * fingerprint check rejects a checkpoint taken on a different graph.
+ *
+ * Checkpoints are written to a temporary name and renamed into place, so a
+ * crash while writing never clobbers the previous one.
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "ClientTypes.h"
+
+static const char CHECKPOINT_MAGIC[8] = { 'S', 'I', 'M', 'C', 'K', 'P', 'T', '\0' };
+static const uint32_t CHECKPOINT_VERSION = 4;
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t protocol;
+  uint32_t nodeCount;
+  uint32_t edgeCount;
+  uint32_t buddyCount;
+  uint32_t topology;
+  uint32_t seed;
+  uint32_t timespan;
+
+  // Simulated time the run resumes at
+  uint32_t time;
+  uint32_t reserved;
+
+  uint64_t graphFingerprint;
+};
+
+class CheckpointWriter {
+
+ public:
+  CheckpointWriter()
+    : file_(NULL),
+      failed_(false)
+  { }
+
+  ~CheckpointWriter() {
+    if (file_ != NULL) {
+      fclose(file_);
+      unlink(temporary_.c_str());
+    }
+  }
+
+  // Start a checkpoint at path with header.  On failure returns false and sets error.
+  bool open(const std::string& path, const CheckpointHeader& header, std::string& error) {
+
+    path_ = path;
+    temporary_ = path + ".tmp";
+    file_ = fopen(temporary_.c_str(), "wb");
+
+    if (file_ == NULL) {
+      error = temporary_ + ": " + strerror(errno);
+      return false;
+    }
+
+    setvbuf(file_, NULL, _IOFBF, 1 << 20);
+    (*this).write(header);
+    return true;
+  }
+
+  template<class T>
+  inline void write(const T& value) {
+    (*this).writeBytes(&value, sizeof(T));
+  }
+
+  template<class T>
+  void writeArray(const T* values, const size_t& count) {
+    (*this).write((uint64_t)count);
+    (*this).writeBytes(values, count * sizeof(T));
+  }
+
+  template<class T>
+  inline void writeVector(const std::vector<T>& values) {
+    (*this).writeArray(values.data(), values.size());
+  }
+
+  // Finish the checkpoint and move it into place
+  bool close(std::string& error) {
+
+    bool closed = fclose(file_) == 0;
+    file_ = NULL;
+
+    if (failed_ || !closed) {
+      error = temporary_ + ": " + strerror(errno);
+      unlink(temporary_.c_str());
+      return false;
+    }
+
+    if (rename(temporary_.c_str(), path_.c_str()) != 0) {
+      error = path_ + ": " + strerror(errno);
+      unlink(temporary_.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+ private:
+
+  void writeBytes(const void* data, const size_t& length) {
+    if (!failed_ && length != 0 && fwrite(data, 1, length, file_) != length) {
+      failed_ = true;
+    }
+  }
+
+  std::string path_;
+  std::string temporary_;
+  FILE* file_;
+  bool failed_;
+};
+
+class CheckpointReader {
+
+ public:
+  CheckpointReader()
+    : file_(NULL),
+      failed_(false)
+  { }
+
+  ~CheckpointReader() {
+    if (file_ != NULL) {
+      fclose(file_);
+    }
+  }
+
+  // Open the checkpoint at path and read its header.  On failure returns false and sets error.
+  bool open(const std::string& path, std::string& error) {
+
+    file_ = fopen(path.c_str(), "rb");
+
+    if (file_ == NULL) {
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    setvbuf(file_, NULL, _IOFBF, 1 << 20);
+    (*this).read(header_);
+
+    if (failed_ || memcmp(header_.magic, CHECKPOINT_MAGIC, sizeof(header_.magic)) != 0) {
+      error = path + ": not a checkpoint";
+      return false;
+    }
+
+    if (header_.version != CHECKPOINT_VERSION) {
+      error = path + ": unsupported checkpoint version";
+      return false;
+    }
+
+    return true;
+  }
+
+  inline const CheckpointHeader& getHeader(void) const {
+    return header_;
+  }
+
+  // False once a read has come up short or an array had an unexpected length
+  inline bool isGood(void) const {
+    return !failed_;
+  }
+
+  template<class T>
+  inline void read(T& value) {
+    (*this).readBytes(&value, sizeof(T));
+  }
+
+  // Read an array written by writeArray, which must hold exactly count values
+  template<class T>
+  void readArray(T* values, const size_t& count) {
+    uint64_t length = 0;
+    (*this).read(length);
+
+    if (length != count) {
+      failed_ = true;
+      return;
+    }
+
+    (*this).readBytes(values, count * sizeof(T));
+  }
+
+  // Read into an already sized vector
+  template<class T>
+  inline void readVector(std::vector<T>& values) {
+    (*this).readArray(values.data(), values.size());
+  }
+
+ private:
+
+  void readBytes(void* data, const size_t& length) {
+    if (!failed_ && length != 0 && fread(data, 1, length, file_) != length) {
+      failed_ = true;
+    }
+  }
+
+  FILE* file_;
+  bool failed_;
+  CheckpointHeader header_;
+};
+
+#endif // _CHECKPOINT_H_
@@ -0,0 +1,183 @@
+/*
+ * Churn.h
+ *
+ * Streaming reader for recorded client churn
+ *
+ * A churn file is text, one state switch per line:
+ *
+ *   <seconds> <clientId> online|offline
+ *
+ * in non-decreasing order of time.  Blank lines and lines starting with '#'
+ * are skipped.  Only the next event is held in memory, so a day of
+ * production sessions replays in constant space however long the file is.
+ */
+
+#ifndef _CHURN_H_
+#define _CHURN_H_
+
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include "ClientTypes.h"
+
+class ChurnReader {
+
+ public:
+  // Returned by nextTime() once every event has been replayed
+  static const uint32_t NIL = 0xFFFFFFFF;
+
+  ChurnReader()
+    : file_(NULL),
+      nodeCount_(0),
+      line_(0),
+      pending_(false),
+      nextTime_(0),
+      nextClient_(0),
+      nextState_(OFFLINE)
+  { }
+
+  ~ChurnReader() {
+    if (file_ != NULL) {
+      fclose(file_);
+    }
+  }
+
+  // Open path for a population of nodeCount clients and read its first
+  // event.  On failure returns false and sets error.
+  bool open(const std::string& path, const uint32_t& nodeCount, std::string& error) {
+
+    file_ = fopen(path.c_str(), "r");
+
+    if (file_ == NULL) {
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    setvbuf(file_, NULL, _IOFBF, 1 << 20);
+    path_ = path;
+    nodeCount_ = nodeCount;
+
+    (*this).readNext();
+
+    if (!error_.empty()) {
+      error = error_;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Time of the next event, or NIL if there are none left
+  inline uint32_t nextTime(void) const {
+    return pending_ ? nextTime_ : NIL;
+  }
+
+  // Describes the line replay stopped at, if it was malformed
+  inline const std::string& getError(void) const {
+    return error_;
+  }
+
+  // Replay every event at or before timestamp, in file order, calling
+  // handler(clientId, state, time) for each
+  template<class Handler>
+  void advance(const uint32_t& timestamp, Handler handler) {
+    while (pending_ && nextTime_ <= timestamp) {
+      handler(nextClient_, nextState_, nextTime_);
+      (*this).readNext();
+    }
+  }
+
+  // Drop the events before timestamp without replaying them
+  void skip(const uint32_t& timestamp) {
+    while (pending_ && nextTime_ < timestamp) {
+      (*this).readNext();
+    }
+  }
+
+ private:
+
+  // Parse the next event, clearing pending_ at the end of the file or on a
+  // malformed line
+  void readNext(void) {
+
+    char buffer[256];
+    uint32_t previousTime = nextTime_;
+
+    pending_ = false;
+
+    while (fgets(buffer, sizeof(buffer), file_) != NULL) {
+
+      line_++;
+
+      char* cursor = buffer;
+
+      while (*cursor == ' ' || *cursor == '\t') {
+	cursor++;
+      }
+
+      if (*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') {
+	continue;
+      }
+
+      char* afterTime = NULL;
+      char* afterClient = NULL;
+      char state[16] = { 0 };
+
+      unsigned long time = strtoul(cursor, &afterTime, 10);
+      unsigned long clientId = strtoul(afterTime, &afterClient, 10);
+
+      if (afterTime == cursor || afterClient == afterTime || time >= NIL
+	  || sscanf(afterClient, "%15s", state) != 1) {
+	(*this).fail("malformed churn event");
+	return;
+      }
+
+      if (clientId >= nodeCount_) {
+	(*this).fail("client id out of range");
+	return;
+      }
+
+      if (time < previousTime) {
+	(*this).fail("churn events out of order");
+	return;
+      }
+
+      if (strcmp(state, "online") == 0) {
+	nextState_ = ONLINE;
+      } else if (strcmp(state, "offline") == 0) {
+	nextState_ = OFFLINE;
+      } else {
+	(*this).fail("state must be online or offline");
+	return;
+      }
+
+      nextTime_ = time;
+      nextClient_ = clientId;
+      pending_ = true;
+      return;
+    }
+  }
+
+  void fail(const char* message) {
+    std::ostringstream error;
+    error << path_ << ":" << line_ << ": " << message;
+    error_ = error.str();
+  }
+
+  FILE* file_;
+  std::string path_;
+  uint32_t nodeCount_;
+  uint32_t line_;
+  std::string error_;
+
+  bool pending_;
+  uint32_t nextTime_;
+  clientId_t nextClient_;
+  ClientState nextState_;
+};
+
+#endif // _CHURN_H_
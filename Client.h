@@ -11,411 +11,455 @@
  * HeartbeatClient
  *  - Utilizes a trivial round robin "heartbeating" protocol to keep buddy network
  *    up-to-date with latest status information.
+ *
+ * A Client implements its protocol for the whole population at once.  Shared
+ * client state lives in a ClientTable, and each protocol keeps its own
+ * counters in dense arrays indexed by clientId (or by BuddyGraph edge).
+ *
+ * Protocol calls are made from worker threads, each owning a partition of the
+ * clients.  They may only modify the state of the client they are called
+ * for, send messages and record statistics through the calling Worker, and
+ * draw random numbers from that client's stream in the ClientTable.
+ *
+ * Messages are delivered in batches, one per recipient per superstep (see
+ * MessageBatch.h).  By default each is handled on its own, and a protocol can
+ * provide its own handleMessages to share work across the batch.
+ *
+ * Protocols derive from Client<Protocol> and are resolved statically: the
+ * simulator is instantiated for one protocol and calls it directly, and the
+ * base class reaches the protocol through derived(), so the hot loops inline
+ * the protocol's calls instead of going through a vtable.  A protocol must
+ * provide
+ *
+ *   void handleMessage(const ClientMessage& message, Worker& worker)
+ *   void runTasks(const clientId_t& clientId, const uint32_t& timestamp, Worker& worker)
+ *   void save(CheckpointWriter& writer) const
+ *   void restore(CheckpointReader& reader)
+ *
+ * where save and restore cover the protocol's own per-client state.
  */
 
 #ifndef _CLIENT_H_
 #define _CLIENT_H_
 
 #include "ClientTypes.h"
+#include "ClientTable.h"
+#include "Worker.h"
+#include "MessageBatch.h"
 #include "Stats.h"
+#include "Checkpoint.h"
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
+template<class Protocol>
 class Client {
 
  public:
- Client(const clientId_t& clientId, 
-	const uint32_t& buddyCount, 
-	const uint32_t& nodeCount, 
-	const uint32_t& initialSleepPeriod,
-	const ClientState& initialState,
-	MessageQueue* messageQueue,
+ Client(ClientTable* table,
 	SimulatorStatistics* stats)
-   : clientId_(clientId),
-     buddyCount_(buddyCount),
-     observerCount_(0),
-     nodeCount_(nodeCount),
-     sleepPeriod_(initialSleepPeriod),
-     state_(initialState),
-     messageQueue_(messageQueue),
+   : table_(table),
      stats_(stats)
   { }
 
-  virtual ClientState switchState(const uint32_t timestamp) {
-    if (state_ == ONLINE) {
-      state_ = OFFLINE;
+  ClientState switchState(const clientId_t& clientId, const uint32_t timestamp) {
+    if ((*table_).isOnline(clientId)) {
+      (*table_).setState(clientId, OFFLINE);
     } else {
-      state_ = ONLINE;
-    }
-    
-    return state_;
-  }
-
-  bool addBuddy(const clientId_t& buddyId, const ClientState& buddyState) {
-
-    if (clientId_ == buddyId || buddiesSet_.find(buddyId) != buddiesSet_.end()) {
-      return false;
+      (*table_).setState(clientId, ONLINE);
     }
 
-    buddies_.push_back(buddyId);
-    buddiesSet_.insert(buddyId);
-    buddyState_[buddyId] = buddyState;
-
-    return true;
+    return (*table_).getState(clientId);
   }
 
-  bool addObserver(const clientId_t& clientId) {
+  // Check every client's buddy records against the ground truth
+  void VerifyState(void) {
 
-    if (clientId_ == clientId || observersSet_.find(clientId) != observersSet_.end()) {
-      return false;
-    }
+    size_t totalRecords = (*table_).getEdgeCount();
+    size_t incorrectRecords = (*table_).countIncorrectBuddyStates();
 
-    observers_.push_back(clientId);
-    observersSet_.insert(clientId);
-    observerCount_++;
-    return true;
+    // Runs on the event loop's thread
+    StatShard& stats = (*stats_).getShard(0);
+    stats.addTotalBuddyRecords(totalRecords);
+    stats.addTotalCorrectBuddyRecords(totalRecords - incorrectRecords);
   }
 
-  void VerifyState(ClientStateMap& stateMap) {
-    
-    uint32_t totalRecords = 0;
-    uint32_t correctRecords = 0;
-    
-    for (ClientStateMap::const_iterator i = buddyState_.begin(); i != buddyState_.end(); i++) {
-      
-      (*stats_).incrementTotalBuddyRecords();
-      
-      if ( stateMap[(*i).first] == (*i).second ) {
-	(*stats_).incrementTotalCorrectBuddyRecords();
-      } 
-
-    }
+  inline ClientState getState(const clientId_t& clientId) const {
+    return (*table_).getState(clientId);
   }
 
-  inline clientId_t getClientId(void) const {
-    return clientId_;
+  inline size_t getBuddyCount(const clientId_t& clientId) const {
+    return (*table_).getGraph().getBuddyCount(clientId);
   }
 
-  inline ClientState getState(void) const {
-    return state_;
-  }
-    
-  inline size_t getBuddyCount(void) const {
-    return buddiesSet_.size();
+  inline bool isOnline(const clientId_t& clientId) const {
+    return (*table_).isOnline(clientId);
   }
 
-  inline bool isOnline(void) const {
-    return state_ == ONLINE;
+  // Handle a superstep's messages for one client, in delivery order
+  void handleMessages(MessageBatch& batch, Worker& worker) {
+    for (const ClientMessage* message = batch.next(); message != NULL; message = batch.next()) {
+      (*this).derived().handleMessage(*message, worker);
+    }
   }
 
-  inline uint32_t getSleepPeriod(void) const {
-    return sleepPeriod_;
-  }
+ protected:
 
-  inline void setSleepPeriod(const uint32_t& sleepPeriod) {
-    sleepPeriod_ = sleepPeriod;
+  inline Protocol& derived(void) {
+    return static_cast<Protocol&>(*this);
   }
 
-  virtual void handleMessage(const ClientMessage& message) = 0;
-  virtual void runTasks(const uint32_t& timestamp) = 0;
-
- protected:
-  
-  ClientMessage createMessage(const clientId_t& recipientId, 
+  ClientMessage createMessage(const clientId_t& senderId,
+			      const clientId_t& recipientId,
 			      const ClientMessageType& type,
 			      const uint32_t& timestamp,
-			      const uint32_t& gossipId,
-			      ClientSet& clientChain) {
+			      const chainId_t& clientChain) {
 
     ClientMessage message;
     message.recipientId = recipientId;
-    message.senderId = clientId_;
-    message.gossipId = gossipId;
+    message.senderId = senderId;
     message.messageType = type;
     message.clientChain = clientChain;
     message.timestamp = timestamp;
     return message;
   }
-  
- protected:
-  clientId_t clientId_;
-
-  uint32_t buddyCount_;
-  uint32_t nodeCount_;
-  uint32_t sleepPeriod_;
-  uint32_t observerCount_;
-
-  ClientState state_;
 
-  ClientList buddies_;
-  ClientList observers_;
-
-  ClientSet buddiesSet_;
-  ClientSet observersSet_;
-
-  ClientStateMap buddyState_;
-
-  MessageQueue* messageQueue_;
+ protected:
+  ClientTable* table_;
   SimulatorStatistics* stats_;
 };
 
 
-class GossipClient : public Client{
+class GossipClient : public Client<GossipClient> {
 
  public:
 
- GossipClient(const clientId_t& clientId, 
-	      const uint32_t& buddyCount, 
-	      const uint32_t& nodeCount, 
-	      const uint32_t& initialSleepPeriod,
-	      const ClientState& initialState, 
-	      MessageQueue* messageQueue,
+  static const ProtocolType PROTOCOL = GOSSIP_PROTOCOL;
+
+ GossipClient(ClientTable* table,
 	      SimulatorStatistics* stats)
-   : Client(clientId, buddyCount, nodeCount, initialSleepPeriod, initialState, messageQueue, stats),
-     lastGossipRequest_(0),
-     messagesSent_(0)
+   : Client<GossipClient>(table, stats),
+     lastGossipRequest_((*table).getNodeCount(), 0),
+     messagesSent_((*table).getNodeCount(), 0)
   { }
 
 
-  virtual void handleMessage(const ClientMessage& message) {
+  void handleMessage(const ClientMessage& message, Worker& worker) {
 
     // OFFLINE clients don't respond to messages
-    if ( !(*this).isOnline() ) {
+    if ( !(*this).isOnline(message.recipientId) ) {
       return;
     }
 
-    // Check if this is a new gossip cycle.  If so, clean up a bit.
-    if (lastGossipRequest_ != message.gossipId) {
-      gossipedNodes_.clear();
-      messagesSent_ = 0;
-      lastGossipRequest_ = message.gossipId;
-      
-      // At beginning of every gossip phase we assume all clients to be OFFLINE
-      for (ClientStateMap::iterator i = buddyState_.begin(); i != buddyState_.end(); i++) {
-	buddyState_[ (*i).first ] = OFFLINE;
-
-	if ( (*stats_).getLastState( (*i).first ) == OFFLINE ) {
-	  (*stats_).incrementPresenceUpdates();
-	  uint32_t senderSwitchTime = (*stats_).getLastStateSwitch(message.senderId);
-	  uint32_t delta = message.timestamp - senderSwitchTime;
-	  (*stats_).addConvergenceTime(delta);
-	}
+    bool buddiesOnline = false;
+    (*this).gossip(message, buddiesOnline, worker);
+  }
 
-      }
+  // Only the first message of a gossip cycle that a client forwards can
+  // change its views of its buddies, so the rest of the batch skips them
+  void handleMessages(MessageBatch& batch, Worker& worker) {
+
+    if ( !(*this).isOnline(batch.getRecipient()) ) {
+      batch.skip();
+      return;
     }
-    
-    // Can only forward a maxiumu of 5 messages/minute
-    if (messagesSent_ >= 5 ) {
+
+    bool buddiesOnline = false;
+
+    for (const ClientMessage* message = batch.next(); message != NULL; message = batch.next()) {
+      (*this).gossip(*message, buddiesOnline, worker);
+    }
+  }
+
+  void runTasks(const clientId_t& clientId, const uint32_t& timestamp, Worker& worker) {
+
+    // OFFLINE clients can't run tasks
+    if ( !(*this).isOnline(clientId) ) {
       return;
     }
-    
-    
-    // Select a random buddy
-    clientId_t randomNode = rand() % observers_.size();
-    
-    // Shouldn't be possible to have yourself as a buddy, by check anyway
-    while (observers_[randomNode] == clientId_) {
-      randomNode = rand() % buddies_.size();
+
+    const BuddyGraph& graph = (*table_).getGraph();
+    uint32_t observerBegin = graph.getObserverBegin(clientId);
+    uint32_t observerCount = graph.getObserverCount(clientId);
+
+    // Nobody to gossip to
+    if (observerCount == 0) {
+      return;
     }
-    
-    // Insert the gossiped client chain into our known gossiped nodes
-    ClientSet clientChain = message.clientChain;
-    gossipedNodes_.insert(clientChain.begin(), clientChain.end());
 
-    // Anyone that has forward the gossip chain along is ONLINE
-    for (ClientStateMap::iterator i = buddyState_.begin(); i != buddyState_.end(); i++) {
+    // Pick two random buddies to start our gossip chain, or the only one there is
+    messagesSent_[clientId] = std::min(observerCount, (uint32_t)2);
 
-      // If this is a state switch, record it in our stats package
-      if (buddyState_[ (*i).first ] != ONLINE) {
+    uint32_t randomNode1 = (*table_).random(clientId) % observerCount;
 
-	if ( (*stats_).getLastState( (*i).first ) == ONLINE ) {
-	  (*stats_).incrementPresenceUpdates();
-	  uint32_t senderSwitchTime = (*stats_).getLastStateSwitch(message.senderId);
-	  uint32_t delta = message.timestamp - senderSwitchTime;
-	  (*stats_).addConvergenceTime(delta);
-	}
+    while (graph.getObserver(observerBegin + randomNode1) == clientId) {
+      randomNode1 = (*table_).random(clientId) % observerCount;
+    }
 
-      }
-      
-      buddyState_[ (*i).first ] = ONLINE;
+    // Start the gossip chain with ourselves and the current time
+    lastGossipRequest_[clientId] = timestamp;
+    chainId_t clientChain = worker.appendChain(NIL_CHAIN, clientId);
+
+    // Send the messages
+    worker.send( createMessage(clientId,
+			       graph.getObserver(observerBegin + randomNode1),
+			       GOSSIP,
+			       timestamp,
+			       clientChain) );
+
+    if (observerCount < 2) {
+      return;
     }
-    
-    // Insert self into the gossiped client chain
-    clientChain.insert(clientId_);    
 
-    // Forward it along
-    (*messageQueue_).push( createMessage(observers_[randomNode],
-					 GOSSIP,
-					 message.timestamp,
-					 message.gossipId,
-					 clientChain) );
-    messagesSent_++;
+    uint32_t randomNode2 = (*table_).random(clientId) % observerCount;
+
+    while (graph.getObserver(observerBegin + randomNode2) == clientId || randomNode2 == randomNode1) {
+      randomNode2 = (*table_).random(clientId) % observerCount;
+    }
+
+    worker.send( createMessage(clientId,
+			       graph.getObserver(observerBegin + randomNode2),
+			       GOSSIP,
+			       timestamp,
+			       clientChain) );
   }
 
-  virtual void runTasks(const uint32_t& timestamp) {
-    
-    // OFFLINE clients can't run tasks
-    if ( !(*this).isOnline() ) {
+  void save(CheckpointWriter& writer) const {
+    writer.writeVector(lastGossipRequest_);
+    writer.writeVector(messagesSent_);
+  }
+
+  void restore(CheckpointReader& reader) {
+    reader.readVector(lastGossipRequest_);
+    reader.readVector(messagesSent_);
+  }
+
+ private:
+
+  // Handle message for an ONLINE client.  buddiesOnline is set once the
+  // client's views of its buddies are all ONLINE in the current gossip cycle.
+  inline void gossip(const ClientMessage& message, bool& buddiesOnline, Worker& worker) {
+
+    clientId_t clientId = message.recipientId;
+
+    const BuddyGraph& graph = (*table_).getGraph();
+    uint32_t buddyBegin = graph.getBuddyBegin(clientId);
+    uint32_t buddyEnd = graph.getBuddyEnd(clientId);
+
+    // Every presence update a message causes converges after the same delay,
+    // so count them up and report them in one go
+    uint32_t presenceUpdates = 0;
+
+    // Check if this is a new gossip cycle.  If so, clean up a bit.
+    // The round a gossip message started in identifies its cycle
+    if (lastGossipRequest_[clientId] != message.timestamp) {
+      messagesSent_[clientId] = 0;
+      lastGossipRequest_[clientId] = message.timestamp;
+
+      // At beginning of every gossip phase we assume all clients to be OFFLINE
+      for (uint32_t edge = buddyBegin; edge != buddyEnd; edge++) {
+	if ( (*stats_).getLastState( graph.getBuddy(edge) ) == OFFLINE ) {
+	  presenceUpdates++;
+	}
+      }
+
+      (*table_).setBuddyStates(clientId, OFFLINE);
+      buddiesOnline = false;
+    }
+
+    uint32_t observerBegin = graph.getObserverBegin(clientId);
+    uint32_t observerCount = graph.getObserverCount(clientId);
+
+    // Can only forward a maxiumu of 5 messages/minute, and only if someone observes us
+    if (messagesSent_[clientId] >= 5 || observerCount == 0) {
+      (*this).recordPresenceUpdates(presenceUpdates, message, worker);
       return;
-    } 
-    
-    // Pick two random buddies to start our gossip chain
-    messagesSent_ = 2;
-    gossipedNodes_.clear();
+    }
 
-    clientId_t randomNode1 = rand() % observers_.size();
-    clientId_t randomNode2 = rand() % observers_.size();
+    // Select a random buddy
+    clientId_t randomNode = graph.getObserver(observerBegin + (*table_).random(clientId) % observerCount);
 
-    while (observers_[randomNode1] == clientId_) {
-      randomNode1 = rand() % observers_.size();
+    // Shouldn't be possible to have yourself as a buddy, by check anyway
+    while (randomNode == clientId) {
+      randomNode = graph.getObserver(observerBegin + (*table_).random(clientId) % observerCount);
     }
 
-    while (buddies_[randomNode2] == clientId_ || randomNode2 == randomNode1) {
-      randomNode2 = rand() % buddies_.size();
+    // Anyone that has forward the gossip chain along is ONLINE
+    if (!buddiesOnline) {
+      for (uint32_t edge = buddyBegin; edge != buddyEnd; edge++) {
+
+	// If this is a state switch, record it in our stats package
+	if ((*table_).getBuddyState(edge) != ONLINE &&
+	    (*stats_).getLastState( graph.getBuddy(edge) ) == ONLINE) {
+	  presenceUpdates++;
+	}
+      }
+
+      (*table_).setBuddyStates(clientId, ONLINE);
+      buddiesOnline = true;
     }
-    
-    // Start the gossip chain with ourselves and the current time
-    lastGossipRequest_ = timestamp;
-    ClientSet clientChain;
-    clientChain.insert(clientId_);
 
-    // Send the messages
-    (*messageQueue_).push( createMessage(observers_[randomNode1],
-					 GOSSIP,
-					 timestamp,
-					 timestamp,
-					 clientChain) );
-
-    (*messageQueue_).push( createMessage(observers_[randomNode2],
-    					 GOSSIP,
-					 timestamp,
-					 timestamp,
-					 clientChain) );
+    (*this).recordPresenceUpdates(presenceUpdates, message, worker);
+
+    // Append self to the gossiped client chain, sharing the rest of it
+    chainId_t clientChain = worker.appendChain(message.clientChain, clientId);
+
+    // Forward it along
+    worker.send( createMessage(clientId,
+			       randomNode,
+			       GOSSIP,
+			       message.timestamp,
+			       clientChain) );
+    messagesSent_[clientId]++;
   }
-      
- private:
-  
-  uint32_t lastGossipRequest_;
-  uint32_t messagesSent_;
 
-  std::hash_map<clientId_t, uint32_t> lastBuddyUpdate_;
+  // Presence updates are timed from when the message's sender last switched state
+  inline void recordPresenceUpdates(const uint32_t& count, const ClientMessage& message, Worker& worker) {
+    if (count != 0) {
+      uint32_t delta = message.timestamp - (*stats_).getLastStateSwitch(message.senderId);
+      worker.getStats().addPresenceUpdates(count, (uint64_t)count * delta);
+    }
+  }
 
-  ClientSet gossipedNodes_;
+  std::vector<uint32_t> lastGossipRequest_;
+  std::vector<uint32_t> messagesSent_;
 };
 
-class HeartbeatClient : public Client{
+class HeartbeatClient : public Client<HeartbeatClient> {
 
  public:
- HeartbeatClient(const clientId_t& clientId, 
-		 const uint32_t& buddyCount, 
-		 const uint32_t& nodeCount, 
-		 const uint32_t& initialSleepPeriod,
-		 const ClientState& initialState, 
-		 MessageQueue* messageQueue,
-		 SimulatorStatistics* stats)
-   : Client(clientId, buddyCount, nodeCount, initialSleepPeriod, initialState, messageQueue, stats),
-     nextObserver_(0),
-     lastMessageTimestamp_(0)
 
+  static const ProtocolType PROTOCOL = HEARTBEAT_PROTOCOL;
+
+ HeartbeatClient(ClientTable* table,
+		 SimulatorStatistics* stats)
+   : Client<HeartbeatClient>(table, stats),
+     nextObserver_((*table).getNodeCount(), 0),
+     lastMessageTimestamp_((*table).getNodeCount(), 0),
+     lastBuddyUpdate_((*table).getEdgeCount(), 0)
   { }
 
-  virtual ClientState switchState(const uint32_t timestamp) {
-    if (state_ == ONLINE) {
-      state_ = OFFLINE;
-    } else {
-      state_ = ONLINE;
+  void handleMessage(const ClientMessage& message, Worker& worker) {
+
+    clientId_t clientId = message.recipientId;
+
+    if ( !(*this).isOnline(clientId) ) {
+      return;
     }
-    
-    return state_;
-  }
 
-  virtual void handleMessage(const ClientMessage& message) {
+    const BuddyGraph& graph = (*table_).getGraph();
 
-    if ( !(*this).isOnline() ) {
+    // Heartbeats only ever go to observers, so the sender is always one of our buddies
+    uint32_t edge = graph.findBuddy(clientId, message.senderId);
+
+    if (edge == graph.getBuddyEnd(clientId)) {
       return;
     }
-    
-    if (buddyState_[message.senderId] == OFFLINE) {
-      (*stats_).incrementPresenceUpdates();
-      
+
+    if ((*table_).getBuddyState(edge) == OFFLINE) {
+      worker.getStats().incrementPresenceUpdates();
+
       uint32_t senderSwitchTime = (*stats_).getLastStateSwitch(message.senderId);
-      ClientState senderState = (*stats_).getLastState(message.senderId);
       uint32_t delta = message.timestamp - senderSwitchTime;
-      uint32_t lastBuddyUpdate = lastBuddyUpdate_[message.senderId];
-      
-      (*stats_).addConvergenceTime(delta);
+
+      worker.getStats().addConvergenceTime(delta);
     }
-    
-    buddyState_[message.senderId] = ONLINE;
-    lastBuddyUpdate_[message.senderId] = message.timestamp;
+
+    (*table_).setBuddyState(edge, ONLINE);
+    lastBuddyUpdate_[edge] = message.timestamp;
   }
-  
-  virtual void runTasks(const uint32_t& timestamp) {
-    
-    if ( !(*this).isOnline() ) {
+
+  void runTasks(const clientId_t& clientId, const uint32_t& timestamp, Worker& worker) {
+
+    if ( !(*this).isOnline(clientId) ) {
       return;
-    } 
-    
-    if (timestamp - lastMessageTimestamp_ > 11) {
-
-      ClientSet nil;
-      (*messageQueue_).push( (*this).createMessage(observers_[nextObserver_], HEARTBEAT, timestamp, 0, nil) );
-      
-      lastMessageTimestamp_ = timestamp;
-      
-      if (++nextObserver_ >= observers_.size()) {
-	nextObserver_ = 0;
+    }
+
+    const BuddyGraph& graph = (*table_).getGraph();
+    uint32_t observerCount = graph.getObserverCount(clientId);
+
+    if (timestamp - lastMessageTimestamp_[clientId] > 11) {
+
+      // A client nobody observes lets its heartbeat slot pass unused
+      if (observerCount != 0) {
+	clientId_t observer = graph.getObserver(graph.getObserverBegin(clientId) + nextObserver_[clientId]);
+	worker.send( (*this).createMessage(clientId, observer, HEARTBEAT, timestamp, NIL_CHAIN) );
+      }
+
+      lastMessageTimestamp_[clientId] = timestamp;
+
+      if (++nextObserver_[clientId] >= observerCount) {
+	nextObserver_[clientId] = 0;
       }
 
     }
-    
-    for (ClientList::const_iterator i = buddies_.begin(); i != buddies_.end(); i++) {
-      
-      if (buddyState_[*i] == OFFLINE) {
+
+    for (uint32_t edge = graph.getBuddyBegin(clientId); edge != graph.getBuddyEnd(clientId); edge++) {
+
+      if ((*table_).getBuddyState(edge) == OFFLINE) {
 	continue;
       }
 
-      uint32_t lastBuddyUpdate = 0;
-    
-      if (lastBuddyUpdate_.find(*i) != lastBuddyUpdate_.end()) {
-	lastBuddyUpdate = lastBuddyUpdate_[*i];
-      }
-      
-      uint32_t lastUpdateDelta = timestamp - lastBuddyUpdate;
-      
-      if (lastUpdateDelta > (observers_.size() * 12 * 3)) {
-	  
-	(*stats_).incrementPresenceUpdates();
-	
-	uint32_t senderSwitchTime = (*stats_).getLastStateSwitch(*i);
-	ClientState senderState = (*stats_).getLastState(*i);
-	
+      uint32_t lastUpdateDelta = timestamp - lastBuddyUpdate_[edge];
+
+      if (lastUpdateDelta > getTimeout(graph.getBuddy(edge))) {
+
+	worker.getStats().incrementPresenceUpdates();
+
+	uint32_t senderSwitchTime = (*stats_).getLastStateSwitch(graph.getBuddy(edge));
 	uint32_t delta = timestamp - senderSwitchTime;
-	
-	(*stats_).addConvergenceTime(delta);
-	buddyState_[*i] = OFFLINE;
+
+	worker.getStats().addConvergenceTime(delta);
+	(*table_).setBuddyState(edge, OFFLINE);
       }
     }
   }
-      
- private:
-  
-  uint32_t nextObserver_;
-  uint32_t sleepPeriod_;
-  uint32_t lastMessageTimestamp_;
 
-  uint32_t lastSleepStart_;
-  uint32_t lastSleepEnd_;
+  // Earliest time at which runTasks has work to do: the next heartbeat, or an
+  // ONLINE buddy going quiet for long enough to be marked OFFLINE
+  uint32_t getNextTaskTime(const clientId_t& clientId) const {
+
+    const BuddyGraph& graph = (*table_).getGraph();
+    uint32_t nextTaskTime = lastMessageTimestamp_[clientId] + 12;
 
-  uint32_t lastSleepStart1_;
-  uint32_t lastSleepEnd1_;
+    for (uint32_t edge = graph.getBuddyBegin(clientId); edge != graph.getBuddyEnd(clientId); edge++) {
 
-  uint32_t lastSleepStart2_;
-  uint32_t lastSleepEnd2_;
+      if ((*table_).getBuddyState(edge) == OFFLINE) {
+	continue;
+      }
+
+      nextTaskTime = std::min(nextTaskTime, lastBuddyUpdate_[edge] + getTimeout(graph.getBuddy(edge)) + 1);
+    }
+
+    return nextTaskTime;
+  }
+
+  void save(CheckpointWriter& writer) const {
+    writer.writeVector(nextObserver_);
+    writer.writeVector(lastMessageTimestamp_);
+    writer.writeVector(lastBuddyUpdate_);
+  }
+
+  void restore(CheckpointReader& reader) {
+    reader.readVector(nextObserver_);
+    reader.readVector(lastMessageTimestamp_);
+    reader.readVector(lastBuddyUpdate_);
+  }
+
+ private:
+
+  // A buddy heartbeats each of its observers in turn, once every 12 seconds,
+  // so it is presumed OFFLINE after missing three of its rounds
+  inline uint32_t getTimeout(const clientId_t& buddyId) const {
+    return (*table_).getGraph().getObserverCount(buddyId) * 12 * 3;
+  }
 
-  std::hash_map<clientId_t, uint32_t> lastBuddyUpdate_;
+  std::vector<uint32_t> nextObserver_;
+  std::vector<uint32_t> lastMessageTimestamp_;
 
+  // Indexed by buddy edge
+  std::vector<uint32_t> lastBuddyUpdate_;
 };
 
 
@@ -18,177 +18,658 @@
 
 
 #include <iostream>
-#include "time.h"
+#include <algorithm>
+#include <vector>
 
 #include "ClientTypes.h"
 #include "Stats.h"
 #include "Client.h"
+#include "ClientTable.h"
+#include "GossipChain.h"
+#include "Worker.h"
+#include "WorkerPool.h"
+#include "TimingWheel.h"
+#include "TopologyGenerator.h"
+#include "GraphFile.h"
+#include "Checkpoint.h"
+#include "Churn.h"
+#include "Latency.h"
+#include "Bandwidth.h"
+#include "MessageBatch.h"
 
 
 /*
  * class Simulator
  *
- * Our base simulator template. Derived templates supply a Client implementation
- * and override "void run(void)"
+ * Our base simulator template. Derived classes supply a Client implementation
+ * and override "void run(void)".  Population sizes come from a SimulatorConfig
+ * at runtime.  Client state is held in a ClientTable, and a single Client
+ * instance runs the protocol over the whole table.
+ *
+ * Messages are delivered in bulk-synchronous supersteps.  Every partition's
+ * worker delivers the messages pending for its clients, and the messages
+ * those send in response become pending for the next superstep, until the
+ * network is quiet.  Supersteps with enough traffic run on the worker pool,
+ * and the rest run on the calling thread.
+ *
+ * Over links with latency, messages stay in flight in their sender's worker
+ * until the second they are due.  Every event loop iteration first delivers
+ * the messages due, and the loops never skip a second with deliveries.
+ *
+ * Between event loop iterations the only messages are those in flight, so
+ * the whole simulator can be checkpointed there and a run restored from any
+ * checkpoint continues exactly as the original would have.
  *
  */
-template<class ClientType, uint32_t nodeCount, uint32_t buddyCount, uint32_t timespan> 
+template<class ClientType> 
   class ClientSimulator {
   
  public:
  
- ClientSimulator()
- : messageQueue_(new MessageQueue()),
-   stats_(new SimulatorStatistics())
+ ClientSimulator(const SimulatorConfig& config)
+ : nodeCount_(config.nodeCount),
+   buddyCount_(config.buddyCount),
+   timespan_(config.timespan),
+   threadCount_(config.threadCount),
+   partitionSize_((config.nodeCount + config.threadCount - 1) / config.threadCount),
+   topology_(config.topology),
+   graphFile_(config.graph),
+   startTime_(0),
+   checkpointPath_(config.checkpointPath),
+   checkpointInterval_(config.checkpointInterval),
+   churn_(config.churn),
+   churnFailed_(false),
+   table_(config.nodeCount, config.seed),
+   clients_(NULL),
+   chains_(new ChainArena(config.threadCount)),
+   chainCompactionSize_(MIN_CHAIN_COMPACTION),
+   stats_(new SimulatorStatistics(config.nodeCount, config.threadCount)),
+   pool_(config.threadCount),
+   sleepSchedule_(config.nodeCount),
+   bandwidth_(config)
  { 
-   srand(time(NULL));
+   if (config.latency != NULL) {
+     latency_ = *config.latency;
+   }
+
+   latency_.setSeed(config.seed);
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     workers_.push_back(new Worker(i, threadCount_, partitionSize_, chains_, &(*stats_).getShard(i), &latency_, &bandwidth_));
+     (*workers_[i]).setTrace(config.trace);
+   }
+
    initialize();   
  }
 
 
  ~ClientSimulator() {
+   delete clients_;
 
-   for (int i = 0; i < nodeCount; i++) {
-     delete clients_[i];
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     delete workers_[i];
    }
-   
-   delete messageQueue_;
+
+   delete chains_;
    delete stats_;
  }
 
  // Our main event loop, implemented by derived template classes.
  virtual void run(void) = 0;
+
+ inline const BuddyGraph& getGraph(void) const {
+   return table_.getGraph();
+ }
+
+ // Continue from a checkpoint taken on the same graph.  The reader's header
+ // has already been read.  On failure returns false and sets error.
+ bool restore(CheckpointReader& reader, std::string& error) {
+
+   const CheckpointHeader& header = reader.getHeader();
+
+   if (header.protocol != ClientType::PROTOCOL) {
+     error = "checkpoint is of a different protocol";
+     return false;
+   }
+
+   if (header.nodeCount != nodeCount_ || header.edgeCount != table_.getEdgeCount()
+       || header.graphFingerprint != table_.getGraph().getFingerprint()) {
+     error = "checkpoint was taken on a different buddy graph";
+     return false;
+   }
+
+   startTime_ = header.time;
+   (*this).restoreState(reader);
+
+   if (!(*this).restoreNetwork(reader, error)) {
+     return false;
+   }
+
+   if (!bandwidth_.restore(reader)) {
+     error = "checkpoint was taken with different bandwidth limits";
+     return false;
+   }
+
+   if (!reader.isGood()) {
+     error = "truncated or corrupt checkpoint";
+     return false;
+   }
+
+   // Churn up to the checkpoint has already been replayed
+   if (churn_ != NULL) {
+     (*churn_).skip(startTime_);
+   }
+
+   std::cout << "Restored at " << startTime_ << " seconds" << std::endl;
+   return true;
+ }
  
  protected:
  
  
  void initialize(void) {
 
+   std::cout << "Seed: " << table_.getSeed() << std::endl;
    std::cout << "Initializing Clients...";
    flush(std::cout);
 
    // Client construction
-   for (uint32_t i = 0; i < nodeCount; i++) {
+   for (uint32_t i = 0; i < nodeCount_; i++) {
 
      // Sleep period is random between 0 - 3999
-     uint32_t initialSleepPeriod = rand() % 4000;
+     uint32_t initialSleepPeriod = table_.random(i) % 4000;
 
-     // Construct a client with a random initial state and insert in into our sleep schedule
-     ClientState initialState = (*this).generateRandomState();     
-     clients_[i] = new ClientType(i, buddyCount, nodeCount, initialSleepPeriod, initialState, messageQueue_, stats_);
-     sleepSchedule_[initialSleepPeriod].insert(i);
+     // Give the client a random initial state and insert in into our sleep schedule
+     ClientState initialState = (*this).generateRandomState(i);
+     table_.setState(i, initialState);
+     table_.setSleepPeriod(i, initialSleepPeriod);
+     sleepSchedule_.schedule(i, initialSleepPeriod);
      
      // Add the initial state "switch" to our stats package
-     (*stats_).addStateSwitch(clients_[i]->getClientId(), 0, clients_[i]->getState() );
+     (*stats_).addStateSwitch(i, 0, initialState);
+   }
 
-     // Update our canonical state map
-     clientState_[i] = initialState;
-     
-     // Update our online/offine sets
-     if (initialState == ONLINE) {
-       onlineClients_.insert(i);
-     } else {
-       offlineClients_.insert(i);
-     }
+   std::cout << ".Done!" << std::endl;
+
+   if (graphFile_ != NULL) {
+     std::cout << "Mapping buddy lists...";
+     flush(std::cout);
+     (*graphFile_).attach(table_.getGraph());
+   } else {
+     std::cout << "Generating buddy lists...";
+     flush(std::cout);
+     (*this).generateGraph();
    }
 
+   // Freeze the graph into its CSR buddy and observer arrays
+   table_.freeze(pool_);
+
    std::cout << ".Done!" << std::endl;
-   std::cout << "Generating buddy lists...";
-   flush(std::cout);
+   (*this).reportTopology();
 
-   // Visit every node, populating it with "buddies"
-   for (uint32_t j = 0; j < nodeCount; j++) {
-     
-     if (j % 100 == 0) {
-       std::cout << ".";
-       flush(std::cout);
-     }
+   // The protocol sizes its own per-client and per-edge arrays from the finished table
+   clients_ = new ClientType(&table_, stats_);
+ }
 
-     while (clients_[j]->getBuddyCount() < buddyCount) {
-       
-       clientId_t buddyId = rand() % nodeCount;
-       
-       if (clients_[j]->addBuddy( buddyId, clients_[buddyId]->getState() ) ) {
-	 clients_[buddyId]->addObserver( j );
+ // Fill the buddy graph from the configured topology generator
+ void generateGraph(void) {
+
+   // Size every buddy list, then every worker streams the buddies of its own
+   // partition straight into the graph
+   TopologyGenerator* generator = TopologyGenerator::create(topology_, nodeCount_, buddyCount_);
+   (*generator).prepare(table_);
+
+   std::vector<uint32_t> degrees(nodeCount_);
+
+   for (clientId_t i = 0; i < nodeCount_; i++) {
+     degrees[i] = (*generator).getDegree(i);
+   }
+
+   table_.getGraph().allocate(degrees);
+
+   pool_.run([this, generator](const uint32_t& partition) {
+       BuddyGraph& graph = (*this).table_.getGraph();
+
+       for (clientId_t i = (*this).getPartitionBegin(partition); i != (*this).getPartitionEnd(partition); i++) {
+	 (*generator).generate(i, (*this).table_, graph.getBuddySlots(i));
        }
+     });
+
+   delete generator;
+ }
+ 
+ // Everything that changes as the simulation runs, apart from the messages
+ // in flight, which are saved after it
+ virtual void saveState(CheckpointWriter& writer) const {
+   table_.save(writer);
+   sleepSchedule_.save(writer);
+   (*stats_).save(writer);
+   (*clients_).save(writer);
+ }
+
+ virtual void restoreState(CheckpointReader& reader) {
+   table_.restore(reader);
+   sleepSchedule_.restore(reader);
+   (*stats_).restore(reader);
+   (*clients_).restore(reader);
+ }
+
+ // Every message in flight with its delivery time, each followed by its gossip
+ // chain flattened to client ids, since chain ids depend on the thread count
+ void saveNetwork(CheckpointWriter& writer) const {
+
+   writer.write((uint64_t)getInFlightCount());
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     const Worker& worker = *workers_[i];
+
+     worker.getInFlight().visit(worker.getTime(), [&](const uint32_t& deliveryTime, const ClientMessage& message) {
+
+	 std::vector<clientId_t> chain;
+
+	 for (chainId_t link = message.clientChain; link != NIL_CHAIN; link = (*chains_).getParent(link)) {
+	   chain.push_back((*chains_).getClientId(link));
+	 }
+
+	 writer.write(deliveryTime);
+	 writer.write(message);
+	 writer.write((uint32_t)chain.size());
+	 writer.writeVector(chain);
+       });
+   }
+ }
+
+ // Put the saved messages back in flight from their senders' workers.  Fails
+ // if one is due beyond the latency model's horizon.
+ bool restoreNetwork(CheckpointReader& reader, std::string& error) {
+
+   uint64_t count = 0;
+   reader.read(count);
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     (*workers_[i]).setTime(startTime_);
+   }
+
+   for (uint64_t i = 0; i < count && reader.isGood(); i++) {
+
+     uint32_t deliveryTime = 0;
+     uint32_t length = 0;
+     ClientMessage message;
+
+     reader.read(deliveryTime);
+     reader.read(message);
+     reader.read(length);
+
+     if (length > nodeCount_ || message.senderId >= nodeCount_ || message.recipientId >= nodeCount_) {
+       error = "truncated or corrupt checkpoint";
+       return false;
+     }
+
+     std::vector<clientId_t> chain(length);
+     reader.readVector(chain);
+
+     Worker& worker = *workers_[message.senderId / partitionSize_];
+     message.clientChain = NIL_CHAIN;
+
+     for (uint32_t j = length; j > 0; j--) {
+       message.clientChain = worker.appendChain(message.clientChain, chain[j - 1]);
+     }
+
+     if (!worker.hold(deliveryTime, message)) {
+       error = "checkpoint has messages in flight beyond this --latency";
+       return false;
      }
    }
 
-   std::cout << ".Done!" << std::endl;
+   return true;
  }
- 
- ClientState generateRandomState(void) {
-   if (rand() % 2 == 0) {
+
+ // Checkpoint the run if one is due at timestamp.  A run that can't be
+ // checkpointed carries on regardless.
+ void checkpoint(const uint32_t& timestamp) {
+
+   bool periodic = checkpointInterval_ != 0 && timestamp % checkpointInterval_ == 0 && timestamp != startTime_;
+
+   if (checkpointPath_.empty() || (timestamp != timespan_ && !periodic)) {
+     return;
+   }
+
+   CheckpointHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+   header.version = CHECKPOINT_VERSION;
+   header.protocol = ClientType::PROTOCOL;
+   header.nodeCount = nodeCount_;
+   header.edgeCount = table_.getEdgeCount();
+   header.buddyCount = buddyCount_;
+   header.topology = topology_;
+   header.seed = table_.getSeed();
+   header.timespan = timespan_;
+   header.time = timestamp;
+   header.graphFingerprint = table_.getGraph().getFingerprint();
+
+   CheckpointWriter writer;
+   std::string error;
+
+   if (writer.open(checkpointPath_, header, error)) {
+     (*this).saveState(writer);
+     (*this).saveNetwork(writer);
+     bandwidth_.save(writer);
+     writer.close(error);
+   }
+
+   if (!error.empty()) {
+     std::cerr << "Checkpoint failed: " << error << std::endl;
+   }
+ }
+
+ // First periodic checkpoint strictly after timestamp, or TimingWheel::NIL
+ inline uint32_t nextCheckpoint(const uint32_t& timestamp) const {
+   if (checkpointPath_.empty() || checkpointInterval_ == 0) {
+     return TimingWheel::NIL;
+   }
+
+   return (timestamp / checkpointInterval_ + 1) * checkpointInterval_;
+ }
+
+ // Print the graph's size and its busiest observed client
+ void reportTopology(void) {
+
+   const BuddyGraph& graph = table_.getGraph();
+   uint32_t maxObservers = 0;
+   uint32_t unobserved = 0;
+
+   for (clientId_t i = 0; i < nodeCount_; i++) {
+     maxObservers = std::max(maxObservers, graph.getObserverCount(i));
+     unobserved += graph.getObserverCount(i) == 0;
+   }
+
+   std::cout << "Buddy Edges: " << graph.getEdgeCount() << std::endl;
+   std::cout << "Max Observers: " << maxObservers << std::endl;
+   std::cout << "Unobserved Clients: " << unobserved << std::endl;
+ }
+
+ ClientState generateRandomState(const clientId_t& clientId) {
+   if (table_.random(clientId) % 2 == 0) {
      return ONLINE;
    }
 
    return OFFLINE;
  }
 
- // In-Memory messaging dispatch
- void dispatchMessage( const ClientMessage& message ) {
-   clients_[message.recipientId]->handleMessage(message);
+ // In-Memory messaging dispatch of one recipient's messages.  Returns how many were dropped.
+ uint32_t dispatchMessages( Worker& worker, const uint32_t& begin, const uint32_t& end ) {
+   MessageBatch batch(worker, table_, bandwidth_, begin, end);
+   (*clients_).handleMessages(batch, worker);
+   return batch.getDroppedCount();
  }
 
- // Add messages to the in-memory queue for "dispatch"
- void dispatchPendingMessages(void) {
-   while ( !(*messageQueue_).empty() ) {
-     
-     (*stats_).incrementMessagesSent();
-     
-     // Drop message with 5% probabilty
-     if ( (rand() % 100) < 5 ) {
-       (*stats_).incrementMessagesDropped();
-       (*messageQueue_).pop();
+ // Deliver the messages pending for partition's clients from every worker,
+ // a batch per recipient.  bySender is needed when the messages were not all
+ // sent in this superstep.
+ void deliverMessages(const uint32_t& partition, const bool& bySender = false) {
+
+   Worker& worker = *workers_[partition];
+   uint32_t messagesSent = worker.collectInbox(workers_, bySender);
+   uint32_t messagesDropped = 0;
+
+   for (uint32_t begin = 0, end = 0; begin < messagesSent; begin = end) {
+
+     clientId_t recipient = worker.getInboxMessage(begin).recipientId;
+
+     for (end = begin + 1; end < messagesSent && worker.getInboxMessage(end).recipientId == recipient; end++) { }
+
+     messagesDropped += (*this).dispatchMessages( worker, begin, end );
+   }
+
+   worker.getStats().addMessagesSent(messagesSent);
+   worker.getStats().addMessagesDropped(messagesDropped);
+ }
+
+ // Where the budgets were exceeded, if any were set
+ void reportBandwidth(void) const {
+
+   if (!bandwidth_.isLimited()) {
+     return;
+   }
+
+   std::cout << "Inbound Overflows: " << (*stats_).getTotalInboundOverflows() << std::endl;
+   std::cout << "Early Drops: " << (*stats_).getTotalEarlyDrops() << std::endl;
+   std::cout << "Outbound Overflows: " << (*stats_).getTotalOutboundOverflows() << std::endl;
+
+   if (!bandwidth_.isInboundLimited()) {
+     return;
+   }
+
+   std::cout << "Overflowing Clients: " << bandwidth_.getOverflowingClientCount() << std::endl;
+
+   clientId_t worst = bandwidth_.getWorstClient();
+
+   if (worst != Bandwidth::NIL) {
+     std::cout << "First Overflow: " << bandwidth_.getFirstOverflow() << " seconds" << std::endl;
+     std::cout << "Most Overflowed Client: " << worst << " (" << bandwidth_.getOverflowCount(worst) << " overflows, "
+	       << table_.getGraph().getObserverCount(worst) << " observers)" << std::endl;
+   }
+ }
+
+ // Make every worker's sent messages pending.  Returns how many there are.
+ size_t exchangeMessages(void) {
+   size_t pending = 0;
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     pending += (*workers_[i]).flip();
+   }
+
+   return pending;
+ }
+
+ // Deliver every sent message, including those sent in response, then
+ // recycle the gossip chains once no message in flight refers to them.  If
+ // released is set, the first superstep delivers messages released from flight.
+ void dispatchPendingMessages(const bool& released = false) {
+
+   bool bySender = released;
+
+   for (size_t pending = exchangeMessages(); pending != 0; pending = exchangeMessages()) {
+
+     // Below a few messages per worker, waking the pool costs more than it saves
+     if (pending < (size_t)threadCount_ * 64) {
+       for (uint32_t i = 0; i < threadCount_; i++) {
+	 (*this).deliverMessages(i, bySender);
+       }
      } else {
-       (*this).dispatchMessage( (*messageQueue_).front() );
-       (*messageQueue_).pop();
+       pool_.run([this, bySender](const uint32_t& partition) {
+	   (*this).deliverMessages(partition, bySender);
+	 });
      }
+
+     bySender = false;
+   }
+
+   if (getInFlightCount() == 0) {
+     (*chains_).reset();
+   } else if ((*chains_).getLiveNodeCount() >= chainCompactionSize_) {
+     (*this).compactChains();
+   }
+ }
+
+ // Free the chains no message in flight refers to.  Compacting again only
+ // once the arena has doubled keeps the copying amortized O(1) per append.
+ void compactChains(void) {
+
+   (*chains_).compact([this](auto update) {
+       for (uint32_t i = 0; i < (*this).threadCount_; i++) {
+	 (*(*this).workers_[i]).getInFlight().update([&update](ClientMessage& message) {
+	     update(message.clientChain);
+	   });
+       }
+     });
+
+   chainCompactionSize_ = std::max((*chains_).getLiveNodeCount() * 2, (size_t)MIN_CHAIN_COMPACTION);
+ }
+
+ // Move the network to timestamp and deliver the messages due then
+ void advanceNetwork(const uint32_t& timestamp) {
+
+   size_t due = 0;
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     (*workers_[i]).setTime(timestamp);
+     due += (*workers_[i]).releaseDue();
+   }
+
+   if (due != 0) {
+     (*this).dispatchPendingMessages(true);
+   }
+ }
+
+ // First second after the current one with messages due, or CalendarQueue::NIL
+ uint32_t nextDelivery(void) const {
+   uint32_t next = CalendarQueue::NIL;
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     next = std::min(next, (*workers_[i]).nextDelivery());
+   }
+
+   return next;
+ }
+
+ size_t getInFlightCount(void) const {
+   size_t count = 0;
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     count += (*workers_[i]).getInFlight().size();
+   }
+
+   return count;
+ }
+
+ // Heap allocations made by the message queues and chain arena over the run
+ size_t getMessagePoolAllocations(void) const {
+   size_t allocations = (*chains_).getAllocationCount();
+
+   for (uint32_t i = 0; i < threadCount_; i++) {
+     allocations += (*workers_[i]).getAllocationCount();
+   }
+
+   return allocations;
+ }
+
+ // Clients of partition are [getPartitionBegin(partition), getPartitionEnd(partition))
+ inline clientId_t getPartitionBegin(const uint32_t& partition) const {
+   return std::min(partition * partitionSize_, nodeCount_);
+ }
+
+ inline clientId_t getPartitionEnd(const uint32_t& partition) const {
+   return std::min((partition + 1) * partitionSize_, nodeCount_);
+ }
+
+ // Print a progress line for every 10000 second mark passed when moving from "from" to "to"
+ void reportProgress(const uint32_t& from, const uint32_t& to) {
+   for (uint32_t mark = (from / 10000 + 1) * 10000; mark <= to; mark += 10000) {
+     std::cout << mark << " seconds elapsed" << std::endl; 
+   }
+ }
+
+ // Called after every client state switch so derived simulators can keep their own schedules in step
+ virtual void onStateSwitch(const clientId_t& clientId, const uint32_t& timestamp) { }
+
+ // Switch the state of every client whose sleep period ends at or before
+ // timestamp, or when replaying churn, every client the recording switches
+ void wakeClients(const uint32_t& timestamp) {
+
+   if (churn_ == NULL) {
+     sleepSchedule_.advance(timestamp, [this](const clientId_t& clientId, const uint32_t& when) {
+	 (*this).switchClientState(clientId, when);
+       });
+
+     return;
+   }
+
+   // Recorded events that leave a client in the state it's already in are no-ops
+   (*churn_).advance(timestamp, [this](const clientId_t& clientId, const ClientState& state, const uint32_t& when) {
+       if ((*this).table_.getState(clientId) != state) {
+	 (*this).switchClientState(clientId, when);
+       }
+     });
+
+   if (!churnFailed_ && !(*churn_).getError().empty()) {
+     std::cerr << "Churn replay stopped: " << (*churn_).getError() << std::endl;
+     churnFailed_ = true;
    }
  }
 
+ // Time of the next client wakeup or recorded switch, or TimingWheel::NIL
+ inline uint32_t nextWakeup(void) const {
+   return churn_ == NULL ? sleepSchedule_.nextExpiry() : (*churn_).nextTime();
+ }
+
  // Switch client's state (ONLINE->OFFLINE | OFFLINE->ONLINE)
  void switchClientState(const clientId_t& clientId, const uint32_t& timestamp) {
 
    // Switch the client's state
-   clients_[clientId]->switchState(timestamp);
+   ClientState state = (*clients_).switchState(clientId, timestamp);
    
-   // Set our sleep schedule
-   uint32_t sleepDuration = (rand() % 4000) + 1;
-   sleepSchedule_[timestamp + sleepDuration].insert(clients_[clientId]->getClientId());
-
-   (*stats_).addSleepTime(sleepDuration);
-   (*stats_).incrementSleepStates();
+   // Set our sleep schedule.  Replayed churn has its own, so the period
+   // recorded is the one just spent in the previous state.
+   uint32_t sleepDuration = 0;
+
+   if (churn_ == NULL) {
+     sleepDuration = (table_.random(clientId) % 4000) + 1;
+     sleepSchedule_.schedule(clientId, timestamp + sleepDuration);
+   } else if (timestamp > (*stats_).getLastStateSwitch(clientId)) {
+     sleepDuration = timestamp - (*stats_).getLastStateSwitch(clientId);
+   }
 
-   // Update our global state table
-   clientState_[clients_[clientId]->getClientId()] = clients_[clientId]->getState();
+   table_.setSleepPeriod(clientId, sleepDuration);
 
-   // Update our online and offline sets
-   if (clients_[clientId]->getState() == ONLINE) {
-     offlineClients_.erase(clientId);
-     onlineClients_.insert(clientId);
-   } else {
-     onlineClients_.erase(clientId);
-     offlineClients_.insert(clientId);
-   }
+   StatShard& stats = (*stats_).getShard(0);
+   stats.addSleepTime(sleepDuration);
+   stats.incrementSleepStates();
 
    // Update our global stats
-   (*stats_).addStateSwitch(clients_[clientId]->getClientId(), timestamp, clients_[clientId]->getState());
+   (*stats_).addStateSwitch(clientId, timestamp, state);
+   (*workers_[0]).trace(TRACE_SWITCH, state, timestamp, clientId, clientId);
+
+   (*this).onStateSwitch(clientId, timestamp);
  }
 
  public:
- ClientType* clients_[nodeCount]; 
- 
- ClientSet onlineClients_;
- ClientSet offlineClients_;
+ uint32_t nodeCount_;
+ uint32_t buddyCount_;
+ uint32_t timespan_;
+ uint32_t threadCount_;
+ uint32_t partitionSize_;
+ TopologyType topology_;
+ const GraphFile* graphFile_;
+
+ // Simulated time the event loop starts from, later than 0 for a restored run
+ uint32_t startTime_;
+ std::string checkpointPath_;
+ uint32_t checkpointInterval_;
+ ChurnReader* churn_;
+ LatencyModel latency_;
+ bool churnFailed_;
+
+ ClientTable table_;
+ ClientType* clients_;
  
- MessageQueue* messageQueue_;
+ ChainArena* chains_;
+
+ // Live chain nodes at which the arena is next compacted, while it can't be reset
+ static const size_t MIN_CHAIN_COMPACTION = 1 << 16;
+ size_t chainCompactionSize_;
  SimulatorStatistics* stats_;
 
- ClientStateMap clientState_;
+ // One per thread, indexed by the partition it owns
+ std::vector<Worker*> workers_;
+ WorkerPool pool_;
+
 
- std::hash_map<uint32_t, std::hash_set<clientId_t> > sleepSchedule_;
+ TimingWheel sleepSchedule_;
 
+ // Per-client message budgets and receive queues
+ Bandwidth bandwidth_;
 };
 
 /*
@@ -199,51 +680,47 @@ template<class ClientType, uint32_t nodeCount, uint32_t buddyCount, uint32_t tim
  *
  */
 
-template<uint32_t nodeCount, uint32_t buddyCount, uint32_t timespan>
-  class GossipSimulator : public ClientSimulator<GossipClient, nodeCount, buddyCount, timespan> {
+class GossipSimulator : public ClientSimulator<GossipClient> {
   
  public:
 
- GossipSimulator() 
-   : ClientSimulator<GossipClient, nodeCount, buddyCount, timespan>() {}
+ // Simulated seconds run() gossips past the timespan, with every client ONLINE
+ static const uint32_t CONVERGENCE_SPAN = 1200;
+
+ GossipSimulator(const SimulatorConfig& config) 
+   : ClientSimulator<GossipClient>(config) {}
 
  virtual void run(void) {
     
-    uint32_t timeElapsed = 0;
-    uint32_t convergenceSpan = 1200;
+    uint32_t timeElapsed = (*this).startTime_;
+    uint32_t convergenceSpan = CONVERGENCE_SPAN;
+
+    // Our simulated time event loop.  Each iteration jumps straight to the next
+    // second with something to do: a gossip round, a client waking up or a
+    // checkpoint
+    while (timeElapsed < (*this).timespan_) {
 
-    // Our simulated time event loop.  One iteration == one second of sim time
-    while (timeElapsed < timespan) {
+      (*this).checkpoint(timeElapsed);
+      (*this).advanceNetwork(timeElapsed);
 
       // "Gossip" every minute
       if (timeElapsed % 60 == 0) {
-	
-	// In the GossipClient, runTasks kicks off gossip 
-	for (ClientSet::const_iterator i = (*this).onlineClients_.begin(); i != (*this).onlineClients_.end(); i++) {
-	  (*this).clients_[*i]->runTasks(timeElapsed);       
-	}
-	
-	// Dispatch all messages
-	(*this).dispatchPendingMessages();	
+	(*this).runGossipRound(timeElapsed);
       }
       
-      // Grab the clients that are waking up at this time and switch their states
-      std::hash_set<clientId_t> wakingClients = (*this).sleepSchedule_[timeElapsed];
-      
-      for (std::hash_set<clientId_t>::const_iterator i = wakingClients.begin(); i != wakingClients.end(); i++) {
-	(*this).switchClientState(*i, timeElapsed);
-      }
-      
-      // Clear stale part of sleep schedule
-      (*this).sleepSchedule_.erase(timeElapsed - 1);
+      // Switch the states of the clients that are waking up at this time
+      (*this).wakeClients(timeElapsed);
 
-      timeElapsed++;
-      
-      if (timeElapsed % 10000 == 0) {
-	std::cout << timeElapsed << " seconds elapsed" << std::endl; 
-      }
-      
+      uint32_t nextEvent = std::min(nextGossipRound(timeElapsed), (*this).nextWakeup());
+      nextEvent = std::min(nextEvent, (*this).nextDelivery());
+      nextEvent = std::min(nextEvent, (*this).nextCheckpoint(timeElapsed));
+      nextEvent = std::min(nextEvent, (*this).timespan_);
+
+      (*this).reportProgress(timeElapsed, nextEvent);
+      timeElapsed = nextEvent;
     }
+
+    (*this).checkpoint(timeElapsed);
     
     std::cout << "Total Presence Updates: " << (*this).stats_->getPresenceUpdatesCount() << std::endl;
     std::cout << "Total Messages Sent: " << (*this).stats_->getTotalMessagesSentCount() << std::endl;
@@ -251,6 +728,7 @@ template<uint32_t nodeCount, uint32_t buddyCount, uint32_t timespan>
     std::cout << "Messages / Second: " << (double)(*this).stats_->getTotalMessagesSentCount() / (double)timeElapsed << std::endl;
     std::cout << "Average Time to Converge: " << ((*this).stats_->getPresenceUpdatesCount() == 0 ? 0 : (*this).stats_->getTotalConvergenceTime()/(*this).stats_->getPresenceUpdatesCount()) << std::endl;
     std::cout << "Average Sleep Time: " << ((*this).stats_->getTotalSleepStates() == 0 ? 0 : (*this).stats_->getTotalSleepTime()/(*this).stats_->getTotalSleepStates()) << std::endl;
+    (*this).reportBandwidth();
     
     /*
      *
@@ -262,125 +740,195 @@ template<uint32_t nodeCount, uint32_t buddyCount, uint32_t timespan>
      */
 
     //Switch all clients on
-    for (uint32_t i = 0; i < nodeCount; i++) {
+    for (uint32_t i = 0; i < (*this).nodeCount_; i++) {
       
       clientId_t clientId = i;
       
-      if (!(*this).clients_[clientId]->isOnline()) {
+      if (!(*this).clients_->isOnline(clientId)) {
 	(*this).switchClientState(clientId, timeElapsed);
       }
     }
     
-    while (timeElapsed < timespan + convergenceSpan) {
-      
+    // With state switching disabled only the gossip rounds remain
+    while (timeElapsed < (*this).timespan_ + convergenceSpan) {
+
+      (*this).advanceNetwork(timeElapsed);
+
       if (timeElapsed % 60 == 0) {
-	
-	for (ClientSet::const_iterator i = (*this).onlineClients_.begin(); i != (*this).onlineClients_.end(); i++) {
-	  (*this).clients_[*i]->runTasks(timeElapsed);       
-	}
-	
-	(*this).dispatchPendingMessages();
+	(*this).runGossipRound(timeElapsed);
       }
-      
-      timeElapsed++;      
+
+      uint32_t nextEvent = std::min(nextGossipRound(timeElapsed), (*this).nextDelivery());
+      timeElapsed = std::min(nextEvent, (*this).timespan_ + convergenceSpan);
     }
     
-    for (uint32_t clientId = 0; clientId < nodeCount; clientId++) {
-      (*this).clients_[clientId]->VerifyState((*this).clientState_);
-    }
+    (*this).clients_->VerifyState();
 
     std::cout << "Total Buddy Records: " << (*this).stats_->getTotalBuddyRecords() << std::endl;
     std::cout << "Total Correct Buddy Records: " << (*this).stats_->getTotalCorrectBuddyRecords() << std::endl;
     std::cout << "Accuracy Rate: " << (float)(*this).stats_->getTotalCorrectBuddyRecords()/(float)(*this).stats_->getTotalBuddyRecords() << std::endl;
+    std::cout << "Message Pool Allocations: " << (*this).getMessagePoolAllocations() << std::endl;
     
  }
+
+ protected:
+
+ // Every ONLINE client kicks off gossip, then the gossip runs its course.  In
+ // the GossipClient, runTasks kicks off gossip.
+ void runGossipRound(const uint32_t& timestamp) {
+
+   (*this).pool_.run([this, timestamp](const uint32_t& partition) {
+
+       Worker& worker = *(*this).workers_[partition];
+
+       for (clientId_t i = (*this).getPartitionBegin(partition); i != (*this).getPartitionEnd(partition); i++) {
+	 if ((*this).table_.isOnline(i)) {
+	   (*this).clients_->runTasks(i, timestamp, worker);
+	 }
+       }
+     });
+
+   // Dispatch all messages
+   (*this).dispatchPendingMessages();
+ }
+
+ // First gossip round strictly after timestamp
+ inline uint32_t nextGossipRound(const uint32_t& timestamp) const {
+   return (timestamp / 60 + 1) * 60;
+ }
   
 };
 
   
-template<uint32_t nodeCount, uint32_t buddyCount, uint32_t timespan> 
-  class HeartbeatSimulator : public ClientSimulator<HeartbeatClient, nodeCount, buddyCount, timespan> {
+class HeartbeatSimulator : public ClientSimulator<HeartbeatClient> {
 
  public:
+
+ // Simulated seconds run() heartbeats past the timespan, with every client ONLINE
+ static const uint32_t CONVERGENCE_SPAN = 2200;
+
+ HeartbeatSimulator(const SimulatorConfig& config)
+   : ClientSimulator<HeartbeatClient>(config),
+     taskSchedule_(config.nodeCount)
+ {
+   // ONLINE clients start heartbeating straight away
+   for (uint32_t i = 0; i < (*this).nodeCount_; i++) {
+     if ((*this).clients_->isOnline(i)) {
+       taskSchedule_.schedule(i, 0);
+     }
+   }
+ }
  
  virtual void run(void) {
    
-   uint32_t timeElapsed = 0;
-   uint32_t convergenceSpan = 2200;
+   uint32_t timeElapsed = (*this).startTime_;
+   uint32_t convergenceSpan = CONVERGENCE_SPAN;
 
-   while (timeElapsed < timespan) {
-     
-     //     for (ClientSet::const_iterator i = (*this).onlineClients_.begin(); i != (*this).onlineClients_.end(); i++) {
-     for (int i = 0; i < nodeCount; i++) {
-       clientId_t clientId = i;
-       
-       if (!((*this).clients_[clientId]->isOnline()) ) {
-	 continue;
-       }
-       
-       (*this).clients_[clientId]->runTasks(timeElapsed);
-       (*this).dispatchPendingMessages();
-     }
+   // Each iteration jumps straight to the next second where a client is due to
+   // heartbeat or time out a buddy, a client wakes up or a checkpoint is due
+   while (timeElapsed < (*this).timespan_) {
 
-     std::hash_set<clientId_t> wakingClients = (*this).sleepSchedule_[timeElapsed];
-     
-     for (std::hash_set<clientId_t>::const_iterator i = wakingClients.begin(); i != wakingClients.end(); i++) {
-       (*this).switchClientState(*i, timeElapsed);
-     }
-     
-     (*this).sleepSchedule_.erase(timeElapsed - 1);
-     timeElapsed++;
-     
-     if (timeElapsed % 10000 == 0) {
-       std::cout << timeElapsed << " seconds elapsed" << std::endl; 
-     }
+     (*this).checkpoint(timeElapsed);
+     (*this).advanceNetwork(timeElapsed);
+     (*this).runDueTasks(timeElapsed);
+     (*this).wakeClients(timeElapsed);
+
+     uint32_t nextEvent = std::min(taskSchedule_.nextExpiry(), (*this).nextWakeup());
+     nextEvent = std::min(nextEvent, (*this).nextDelivery());
+     nextEvent = std::min(nextEvent, (*this).nextCheckpoint(timeElapsed));
+     nextEvent = std::min(nextEvent, (*this).timespan_);
+
+     (*this).reportProgress(timeElapsed, nextEvent);
+     timeElapsed = nextEvent;
    }
 
+   (*this).checkpoint(timeElapsed);
+
    std::cout << "Total Presence Updates: " << (*this).stats_->getPresenceUpdatesCount() << std::endl;
    std::cout << "Total Messages Sent: " << (*this).stats_->getTotalMessagesSentCount() << std::endl;
    std::cout << "Total Messages Dropped: " << (*this).stats_->getTotalMessagesDroppedCount() << std::endl;
    std::cout << "Messages / Second: " << (double)(*this).stats_->getTotalMessagesSentCount() / (double)timeElapsed << std::endl;
    std::cout << "Average Time to Converge: " << ((*this).stats_->getPresenceUpdatesCount() == 0 ? 0 : (*this).stats_->getTotalConvergenceTime()/(*this).stats_->getPresenceUpdatesCount()) << std::endl;
    std::cout << "Average Sleep Time: " << ((*this).stats_->getTotalSleepStates() == 0 ? 0 : (*this).stats_->getTotalSleepTime()/(*this).stats_->getTotalSleepStates()) << std::endl;
+   (*this).reportBandwidth();
    
    std::cout << "Converging Clients...";
    flush(std::cout);
 
-   for (uint32_t i = 0; i < nodeCount; i++) {
+   for (uint32_t i = 0; i < (*this).nodeCount_; i++) {
      
      clientId_t clientId = i;
        
-     if (! (*this).clients_[clientId]->isOnline()) {
+     if (! (*this).clients_->isOnline(clientId)) {
        (*this).switchClientState(clientId, 0);
      }
    }
        
-   while (timeElapsed < timespan + convergenceSpan) {
-     
-     if (timeElapsed % 100 == 0) {
+   while (timeElapsed < (*this).timespan_ + convergenceSpan) {
+
+     (*this).advanceNetwork(timeElapsed);
+     (*this).runDueTasks(timeElapsed);
+
+     uint32_t nextEvent = std::min(taskSchedule_.nextExpiry(), (*this).nextDelivery());
+     nextEvent = std::min(nextEvent, (*this).timespan_ + convergenceSpan);
+
+     for (uint32_t mark = (timeElapsed + 99) / 100 * 100; mark < nextEvent; mark += 100) {
        std::cout << ".";
        flush(std::cout);
      }
-
-     for (uint32_t i = 0; i < nodeCount; i++) {
-       clientId_t clientId = i;
-       (*this).clients_[clientId]->runTasks(timeElapsed);
-       (*this).dispatchPendingMessages();
-     }
      
-     timeElapsed++;
+     timeElapsed = nextEvent;
    }
    
    std::cout << ".Done!" << std::endl;
    
-   for (uint32_t clientId = 0; clientId < nodeCount; clientId++) {
-     (*this).clients_[clientId]->VerifyState((*this).clientState_);
-   }
+   (*this).clients_->VerifyState();
    
    std::cout << "Total Buddy Records: " << (*this).stats_->getTotalBuddyRecords() << std::endl;
    std::cout << "Total Correct Buddy Records: " << (*this).stats_->getTotalCorrectBuddyRecords() << std::endl;
    std::cout << "Accuracy Rate: " << (float)(*this).stats_->getTotalCorrectBuddyRecords()/(float)(*this).stats_->getTotalBuddyRecords() << std::endl; 
+   std::cout << "Message Pool Allocations: " << (*this).getMessagePoolAllocations() << std::endl;
+ }
+
+ protected:
+
+ virtual void saveState(CheckpointWriter& writer) const {
+   ClientSimulator<HeartbeatClient>::saveState(writer);
+   taskSchedule_.save(writer);
+ }
+
+ virtual void restoreState(CheckpointReader& reader) {
+   ClientSimulator<HeartbeatClient>::restoreState(reader);
+   taskSchedule_.restore(reader);
+ }
+
+ // Run every client whose protocol timer has expired, then re-arm it for the
+ // next time it has a heartbeat to send or a buddy to time out
+ void runDueTasks(const uint32_t& timestamp) {
+   taskSchedule_.advance(timestamp, [this](const clientId_t& clientId, const uint32_t& when) {
+
+       if (!(*this).clients_->isOnline(clientId)) {
+	 return;
+       }
+
+       // Tasks run on the event loop's thread, as worker 0
+       (*this).clients_->runTasks(clientId, when, *(*this).workers_[0]);
+       (*this).dispatchPendingMessages();
+
+       taskSchedule_.schedule(clientId, (*this).clients_->getNextTaskTime(clientId));
+     });
+ }
+
+ // Clients coming ONLINE start running tasks on the following second
+ virtual void onStateSwitch(const clientId_t& clientId, const uint32_t& timestamp) {
+   if ((*this).clients_->isOnline(clientId)) {
+     taskSchedule_.schedule(clientId, timestamp + 1);
+   } else {
+     taskSchedule_.cancel(clientId);
+   }
  }
+
+ TimingWheel taskSchedule_;
   
 };
   
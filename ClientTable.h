@@ -0,0 +1,170 @@
+/*
+ * ClientTable.h
+ *
+ * Structure-of-arrays storage for the simulated client population
+ *
+ * Per-client state lives in dense arrays indexed by clientId, with presence
+ * packed one bit per client.  The buddy graph is a BuddyGraph, which is frozen
+ * into CSR form once generated, and each client's view of its buddies' states
+ * is a bit per graph edge, aligned with the graph's buddy array.
+ *
+ * Every client also has its own CounterRandom stream.  The table keeps each
+ * stream's position, which only the thread running the client advances.
+ */
+
+#ifndef _CLIENT_TABLE_H_
+#define _CLIENT_TABLE_H_
+
+#include <vector>
+
+#include "ClientTypes.h"
+#include "BuddyGraph.h"
+#include "PresenceBitset.h"
+#include "CounterRandom.h"
+#include "WorkerPool.h"
+#include "Checkpoint.h"
+
+class ClientTable {
+
+ public:
+  ClientTable(const uint32_t& nodeCount, const uint32_t& seed)
+    : nodeCount_(nodeCount),
+      presence_(nodeCount),
+      sleepPeriod_(nodeCount, 0),
+      random_(seed),
+      randomCounters_(nodeCount, 0),
+      graph_(nodeCount)
+  { }
+
+  // Freeze the buddy graph, unless it is attached to a frozen one, and seed
+  // every buddy view with the buddy's current state
+  void freeze(WorkerPool& pool) {
+
+    if (!graph_.isFrozen()) {
+      graph_.freeze(pool);
+    }
+
+    buddyViews_.resize(graph_.getEdgeCount());
+
+    // Workers fill whole words of the views, so none of them are shared
+    uint32_t workerCount = pool.getThreadCount();
+    size_t wordCount = buddyViews_.getWordCount();
+    uint32_t edgeCount = graph_.getEdgeCount();
+
+    pool.run([&](const uint32_t& worker) {
+	for (size_t word = wordCount * worker / workerCount; word != wordCount * (worker + 1) / workerCount; word++) {
+
+	  uint64_t bits = 0;
+	  uint32_t end = std::min((uint32_t)(word * 64 + 64), edgeCount);
+
+	  for (uint32_t edge = word * 64; edge != end; edge++) {
+	    bits |= (uint64_t)presence_.isOnline(graph_.getBuddy(edge)) << (edge & 63);
+	  }
+
+	  buddyViews_.setWord(word, bits);
+	}
+      });
+  }
+
+  inline uint32_t getNodeCount(void) const {
+    return nodeCount_;
+  }
+
+  inline uint32_t getEdgeCount(void) const {
+    return graph_.getEdgeCount();
+  }
+
+  inline ClientState getState(const clientId_t& clientId) const {
+    return presence_.getState(clientId);
+  }
+
+  inline void setState(const clientId_t& clientId, const ClientState& state) {
+    presence_.setState(clientId, state);
+  }
+
+  inline bool isOnline(const clientId_t& clientId) const {
+    return presence_.isOnline(clientId);
+  }
+
+  // Ground truth presence of every client
+  inline const PresenceBitset& getPresence(void) const {
+    return presence_;
+  }
+
+  inline uint32_t getSleepPeriod(const clientId_t& clientId) const {
+    return sleepPeriod_[clientId];
+  }
+
+  inline void setSleepPeriod(const clientId_t& clientId, const uint32_t& sleepPeriod) {
+    sleepPeriod_[clientId] = sleepPeriod;
+  }
+
+  // Next number from clientId's random stream
+  inline uint32_t random(const clientId_t& clientId) {
+    return random_(clientId, randomCounters_[clientId]++);
+  }
+
+  inline uint32_t getSeed(void) const {
+    return random_.getSeed();
+  }
+
+  inline BuddyGraph& getGraph(void) {
+    return graph_;
+  }
+
+  inline const BuddyGraph& getGraph(void) const {
+    return graph_;
+  }
+
+  inline ClientState getBuddyState(const uint32_t& edge) const {
+    return buddyViews_.getState(edge);
+  }
+
+  // Buddy views are updated from the worker threads, so these are safe to
+  // call concurrently for the edges of different clients
+  inline void setBuddyState(const uint32_t& edge, const ClientState& state) {
+    buddyViews_.setStateShared(edge, state);
+  }
+
+  // Set every buddy view of clientId to state
+  inline void setBuddyStates(const clientId_t& clientId, const ClientState& state) {
+    buddyViews_.setRangeShared(graph_.getBuddyBegin(clientId), graph_.getBuddyEnd(clientId), state);
+  }
+
+  // Everything but the graph, which a restored table rebuilds or maps itself
+  void save(CheckpointWriter& writer) const {
+    presence_.save(writer);
+    writer.writeVector(sleepPeriod_);
+    writer.writeVector(randomCounters_);
+    buddyViews_.save(writer);
+  }
+
+  // Restore into a table frozen on the same graph
+  void restore(CheckpointReader& reader) {
+    presence_.restore(reader);
+    reader.readVector(sleepPeriod_);
+    reader.readVector(randomCounters_);
+    buddyViews_.restore(reader);
+  }
+
+  // Number of buddy views that disagree with the ground truth
+  inline size_t countIncorrectBuddyStates(void) const {
+    return PresenceBitset::countMismatches(presence_, buddyViews_, graph_.getBuddies());
+  }
+
+ private:
+  uint32_t nodeCount_;
+
+  PresenceBitset presence_;
+  std::vector<uint32_t> sleepPeriod_;
+
+  CounterRandom random_;
+  std::vector<uint32_t> randomCounters_;
+
+  BuddyGraph graph_;
+
+  // Indexed by buddy edge
+  PresenceBitset buddyViews_;
+};
+
+#endif // _CLIENT_TABLE_H_
@@ -9,9 +9,9 @@
 #define _CLIENT_TYPES_H_
 
 #include <iostream>
-#include <queue>
-#include "hash_map"
-#include "hash_set"
+#include <vector>
+#include <string>
+#include <stdint.h>
 
 enum ClientState {
   ONLINE,
@@ -24,21 +24,116 @@ enum ClientMessageType {
   GOSSIP
 };
 
+enum ProtocolType {
+  GOSSIP_PROTOCOL,
+  HEARTBEAT_PROTOCOL
+};
+
+enum TopologyType {
+  UNIFORM,
+  POWER_LAW,
+  SMALL_WORLD,
+  COMMUNITY
+};
+
+// What a full receive queue does with arriving messages (see Bandwidth.h)
+enum DropPolicy {
+  TAIL_DROP,
+  RANDOM_EARLY_DROP
+};
+
 typedef uint32_t clientId_t;
-typedef std::vector<clientId_t> ClientList;
-typedef std::hash_set<clientId_t> ClientSet;
-typedef std::hash_map<clientId_t, ClientState> ClientStateMap;
 
+// Handle to a gossip chain in a ChainArena (see GossipChain.h)
+typedef uint32_t chainId_t;
+static const chainId_t NIL_CHAIN = 0xFFFFFFFF;
 
+class GraphFile;
+class TraceWriter;
+class ChurnReader;
+class LatencyModel;
+
+
+// Simulated times must stay below this to fit a message's timestamp
+static const uint32_t MAX_MESSAGE_TIMESTAMP = 1u << 30;
+
+/*
+ * A packed 16 byte message header, four to a cache line in the queues.  The
+ * time and type share a word, and anything variable sized travels out of line
+ * in the round's ChainArena, referred to by clientChain.  A gossip message's
+ * timestamp is the time its round started, which also identifies the gossip
+ * cycle.
+ */
 struct ClientMessage {
   clientId_t recipientId;
   clientId_t senderId;
-  uint32_t timestamp;
-  uint32_t gossipId;
-  ClientMessageType messageType;
-  ClientSet clientChain;
+  uint32_t timestamp : 30;
+  ClientMessageType messageType : 2;
+  chainId_t clientChain;
 };
 
-typedef std::queue<ClientMessage> MessageQueue;
+static_assert(sizeof(ClientMessage) == 16, "ClientMessage must pack into 16 bytes");
+
+// Runtime parameters shared by all simulators
+struct SimulatorConfig {
+  SimulatorConfig()
+    : nodeCount(1000),
+      buddyCount(20),
+      timespan(60*60*24*30*3),
+      threadCount(1),
+      seed(0),
+      topology(UNIFORM),
+      graph(NULL),
+      checkpointInterval(0),
+      trace(NULL),
+      churn(NULL),
+      latency(NULL),
+      inboundBudget(0),
+      outboundBudget(0),
+      queueCapacity(0),
+      dropPolicy(TAIL_DROP)
+  { }
+
+  uint32_t nodeCount;
+  uint32_t buddyCount;
+  uint32_t timespan;
+
+  // Worker threads the population is partitioned across
+  uint32_t threadCount;
+
+  // Seed of every client's random stream.  Equal seeds give identical runs.
+  uint32_t seed;
+
+  // Shape of the buddy graph.  buddyCount is the mean number of buddies.
+  TopologyType topology;
+
+  // Mapped buddy graph to use instead of generating one, or NULL.  Its node
+  // count overrides nodeCount and it must outlive the simulator.
+  const GraphFile* graph;
+
+  // Where to checkpoint the run, if anywhere: when the timespan is reached
+  // and, if checkpointInterval is set, at every multiple of it before that
+  std::string checkpointPath;
+  uint32_t checkpointInterval;
+
+  // Opened trace to record the run's events in, or NULL.  It needs a stripe
+  // per thread and must outlive the simulator.
+  TraceWriter* trace;
+
+  // Recorded churn to replay instead of drawing random sleeps, or NULL.  It
+  // must outlive the simulator.
+  ChurnReader* churn;
+
+  // Per-link network latency, or NULL to deliver every message in the tick
+  // it is sent
+  const LatencyModel* latency;
+
+  // Messages a client can handle and send per simulated second, 0 for no
+  // limit, and how many more can wait in its receive queue
+  uint32_t inboundBudget;
+  uint32_t outboundBudget;
+  uint32_t queueCapacity;
+  DropPolicy dropPolicy;
+};
 
 #endif // _CLIENT_TYPES_H_
@@ -0,0 +1,57 @@
+/*
+ * CounterRandom.h
+ *
+ * Counter-based random number streams (Philox2x32-10)
+ *
+ * A counter-based generator has no hidden state: the n'th number of a stream
+ * is a pure function of the seed, the stream and n, computed by ten rounds of
+ * a keyed bijection over the 64 bit (n, stream) block.  Every client draws
+ * from its own stream, so a client's decisions don't depend on how many
+ * numbers other clients have drawn or on which thread runs it, and runs with
+ * the same seed are reproducible at any thread count.
+ *
+ * See Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3" (SC11).
+ */
+
+#ifndef _COUNTER_RANDOM_H_
+#define _COUNTER_RANDOM_H_
+
+#include "ClientTypes.h"
+
+class CounterRandom {
+
+ public:
+  CounterRandom(const uint32_t& seed = 0)
+    : seed_(seed)
+  { }
+
+  inline uint32_t getSeed(void) const {
+    return seed_;
+  }
+
+  // The index'th number of stream
+  inline uint32_t operator()(const uint32_t& stream, const uint32_t& index) const {
+
+    uint32_t lo = index;
+    uint32_t hi = stream;
+    uint32_t key = seed_;
+
+#pragma GCC unroll 10
+    for (int round = 0; round < 10; round++) {
+      uint64_t product = (uint64_t)MULTIPLIER * lo;
+      lo = (uint32_t)(product >> 32) ^ key ^ hi;
+      hi = (uint32_t)product;
+      key += WEYL;
+    }
+
+    return lo;
+  }
+
+ private:
+  static const uint32_t MULTIPLIER = 0xD256D193;
+  static const uint32_t WEYL = 0x9E3779B9;
+
+  uint32_t seed_;
+};
+
+#endif // _COUNTER_RANDOM_H_
@@ -0,0 +1,220 @@
+/*
+ * GossipChain.h
+ *
+ * Shared, immutable chains of the clients a gossip message has passed through
+ *
+ * A chain is a persistent singly linked list running from the newest client
+ * back to the one that started the gossip.  Forwarding a gossip appends one
+ * node whose parent is the incoming chain, so the prefix is shared instead of
+ * copied.  Nodes are bump allocated from a ChainArena, and the whole arena is
+ * reset once every message referring to a chain has been delivered.  The
+ * node arrays only grow, so after the busiest round has been seen no further
+ * allocation takes place.
+ *
+ * Over links with latency, some message is always in flight and the arena
+ * never empties.  compact() then copies just the chains still referred to
+ * into a second set of node arrays, keeping shared prefixes shared, and
+ * frees the rest, so the arena stays proportional to the live chains.
+ *
+ * Each worker thread appends to its own stripe of the arena.  Chain ids are
+ * interleaved across stripes (id = index * stripeCount + stripe), so they stay
+ * unique without any coordination and a chain can freely continue one that
+ * another worker started.
+ */
+
+#ifndef _GOSSIP_CHAIN_H_
+#define _GOSSIP_CHAIN_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "ClientTypes.h"
+
+class ChainArena {
+
+ public:
+  ChainArena(const uint32_t& stripeCount = 1, const size_t& initialCapacity = 1024)
+    : stripeCount_(stripeCount),
+      stripes_(stripeCount)
+  {
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      stripes_[i].nodes.resize(initialCapacity);
+    }
+  }
+
+  // New chain of clientId followed by parent, allocated from stripe
+  inline chainId_t append(const uint32_t& stripe, const chainId_t& parent, const clientId_t& clientId) {
+
+    Stripe& nodes = stripes_[stripe];
+
+    if (nodes.used == nodes.nodes.size()) {
+      nodes.nodes.resize(nodes.nodes.size() * 2);
+      nodes.allocations++;
+    }
+
+    Node& node = nodes.nodes[nodes.used];
+    node.clientId = clientId;
+    node.parent = parent;
+
+    return nodes.used++ * stripeCount_ + stripe;
+  }
+
+  // Free every chain at once.  Only valid when no message references one.
+  void reset(void) {
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      stripes_[i].used = 0;
+    }
+  }
+
+  // Free every chain not reachable from a root.  roots(update) must call
+  // update(chain) on a reference to every chain still in use, which is
+  // rewritten to the chain's new id.  Chains stay in the stripe they were in.
+  template<class Roots>
+  void compact(Roots roots) {
+
+    if (spares_.empty()) {
+      spares_.resize(stripeCount_);
+
+      for (uint32_t i = 0; i < stripeCount_; i++) {
+	spares_[i].allocations = 0;
+      }
+    }
+
+    size_t idCount = 0;
+
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      spares_[i].used = 0;
+      idCount = std::max(idCount, stripes_[i].used * stripeCount_);
+    }
+
+    // New id of every old node copied so far
+    remap_.assign(idCount, NIL_CHAIN);
+
+    roots([this](chainId_t& chain) {
+	chain = (*this).copy(chain);
+      });
+
+    stripes_.swap(spares_);
+  }
+
+  inline clientId_t getClientId(const chainId_t& chain) const {
+    return getNode(chain).clientId;
+  }
+
+  inline chainId_t getParent(const chainId_t& chain) const {
+    return getNode(chain).parent;
+  }
+
+  bool contains(chainId_t chain, const clientId_t& clientId) const {
+    for (; chain != NIL_CHAIN; chain = getNode(chain).parent) {
+      if (getNode(chain).clientId == clientId) {
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t getLiveNodeCount(void) const {
+    size_t count = 0;
+
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      count += stripes_[i].used;
+    }
+
+    return count;
+  }
+
+  // Number of times node arrays have been allocated
+  size_t getAllocationCount(void) const {
+    size_t count = 0;
+
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      count += stripes_[i].allocations;
+    }
+
+    for (size_t i = 0; i < spares_.size(); i++) {
+      count += spares_[i].allocations;
+    }
+
+    return count;
+  }
+
+  // Nodes the arena has room for, across every stripe and spare
+  size_t getCapacity(void) const {
+    size_t capacity = 0;
+
+    for (uint32_t i = 0; i < stripeCount_; i++) {
+      capacity += stripes_[i].nodes.size();
+    }
+
+    for (size_t i = 0; i < spares_.size(); i++) {
+      capacity += spares_[i].nodes.size();
+    }
+
+    return capacity;
+  }
+
+ private:
+
+  struct Node {
+    clientId_t clientId;
+    chainId_t parent;
+  };
+
+  // Written by a single worker, so kept on its own cache line
+  struct alignas(64) Stripe {
+    Stripe() : used(0), allocations(1) { }
+
+    size_t used;
+    size_t allocations;
+    std::vector<Node> nodes;
+  };
+
+  inline const Node& getNode(const chainId_t& chain) const {
+    return stripes_[chain % stripeCount_].nodes[chain / stripeCount_];
+  }
+
+  // Copy chain into the spares, sharing whatever part was already copied
+  chainId_t copy(const chainId_t& chain) {
+
+    // Walk up to the first node already copied
+    path_.clear();
+
+    for (chainId_t link = chain; link != NIL_CHAIN && remap_[link] == NIL_CHAIN; link = getNode(link).parent) {
+      path_.push_back(link);
+    }
+
+    // Then copy the rest from the oldest node down
+    for (size_t i = path_.size(); i > 0; i--) {
+
+      chainId_t link = path_[i - 1];
+      const Node& node = getNode(link);
+      uint32_t stripe = link % stripeCount_;
+      Stripe& spare = spares_[stripe];
+
+      if (spare.used == spare.nodes.size()) {
+	spare.nodes.resize(std::max(spare.nodes.size() * 2, (size_t)1024));
+	spare.allocations++;
+      }
+
+      Node& copied = spare.nodes[spare.used];
+      copied.clientId = node.clientId;
+      copied.parent = node.parent == NIL_CHAIN ? NIL_CHAIN : remap_[node.parent];
+
+      remap_[link] = spare.used++ * stripeCount_ + stripe;
+    }
+
+    return chain == NIL_CHAIN ? NIL_CHAIN : remap_[chain];
+  }
+
+  uint32_t stripeCount_;
+  std::vector<Stripe> stripes_;
+
+  // Node arrays compact() copies live chains into, then swaps with stripes_
+  std::vector<Stripe> spares_;
+  std::vector<chainId_t> remap_;
+  std::vector<chainId_t> path_;
+};
+
+#endif // _GOSSIP_CHAIN_H_
@@ -0,0 +1,304 @@
+/*
+ * GraphFile.h
+ *
+ * Binary buddy graph files, memory mapped read-only
+ *
+ * A graph file holds a frozen BuddyGraph's four CSR arrays (buddy offsets,
+ * buddies, observer offsets, observers) behind a fixed 64 byte header.  Every
+ * section starts on a 64 byte boundary and is stored in host byte order, so a
+ * mapped file is used in place: the graph is attached to the mapping and no
+ * array is copied.  map() reads the whole file once to validate it, and the
+ * pages are shared through the page cache by every process that maps the
+ * same file.
+ *
+ * Files are written to a temporary name and renamed into place, so a reader
+ * never maps a partially written graph.
+ */
+
+#ifndef _GRAPH_FILE_H_
+#define _GRAPH_FILE_H_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ClientTypes.h"
+#include "BuddyGraph.h"
+
+static const char GRAPH_FILE_MAGIC[8] = { 'B', 'U', 'D', 'D', 'Y', 'G', 'R', 'F' };
+static const uint32_t GRAPH_FILE_VERSION = 1;
+
+// Written as a native integer, so a file from a machine of the other byte order reads back swapped
+static const uint32_t GRAPH_FILE_BYTE_ORDER = 0x01020304;
+
+struct GraphFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t nodeCount;
+  uint32_t edgeCount;
+
+  // Byte offsets of each section from the start of the file
+  uint64_t buddyOffsets;
+  uint64_t buddies;
+  uint64_t observerOffsets;
+  uint64_t observers;
+
+  uint64_t fileSize;
+};
+
+class GraphFile {
+
+ public:
+  GraphFile()
+    : data_(NULL),
+      size_(0),
+      header_(NULL)
+  { }
+
+  ~GraphFile() {
+    if (data_ != NULL) {
+      munmap(data_, size_);
+    }
+  }
+
+  // Map path read-only and check its header.  On failure returns false and sets error.
+  bool map(const std::string& path, std::string& error) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    struct stat info;
+
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(GraphFileHeader)) {
+      close(fd);
+      error = path + ": not a graph file";
+      return false;
+    }
+
+    size_ = info.st_size;
+    data_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data_ == MAP_FAILED) {
+      data_ = NULL;
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    header_ = static_cast<const GraphFileHeader*>(data_);
+
+    if (!(*this).validate(error)) {
+      error = path + ": " + error;
+      return false;
+    }
+
+    return true;
+  }
+
+  inline uint32_t getNodeCount(void) const {
+    return (*header_).nodeCount;
+  }
+
+  inline uint32_t getEdgeCount(void) const {
+    return (*header_).edgeCount;
+  }
+
+  // Make graph a frozen view of the mapped arrays.  The file must outlive it.
+  void attach(BuddyGraph& graph) const {
+    graph.attach(section<uint32_t>((*header_).buddyOffsets),
+		 section<clientId_t>((*header_).buddies),
+		 section<uint32_t>((*header_).observerOffsets),
+		 section<clientId_t>((*header_).observers));
+  }
+
+  // Write a frozen graph to path.  On failure returns false and sets error.
+  static bool write(const BuddyGraph& graph, const std::string& path, std::string& error) {
+
+    uint32_t nodeCount = graph.getNodeCount();
+    uint32_t edgeCount = graph.getEdgeCount();
+
+    GraphFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_FILE_VERSION;
+    header.byteOrder = GRAPH_FILE_BYTE_ORDER;
+    header.nodeCount = nodeCount;
+    header.edgeCount = edgeCount;
+    header.buddyOffsets = align(sizeof(header));
+    header.buddies = align(header.buddyOffsets + (uint64_t)(nodeCount + 1) * sizeof(uint32_t));
+    header.observerOffsets = align(header.buddies + (uint64_t)edgeCount * sizeof(clientId_t));
+    header.observers = align(header.observerOffsets + (uint64_t)(nodeCount + 1) * sizeof(uint32_t));
+    header.fileSize = header.observers + (uint64_t)edgeCount * sizeof(clientId_t);
+
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+
+    if (file == NULL) {
+      error = temporary + ": " + strerror(errno);
+      return false;
+    }
+
+    bool written = writeSection(file, 0, &header, sizeof(header))
+      && writeSection(file, header.buddyOffsets, graph.getBuddyOffsets(), (size_t)(nodeCount + 1) * sizeof(uint32_t))
+      && writeSection(file, header.buddies, graph.getBuddies(), (size_t)edgeCount * sizeof(clientId_t))
+      && writeSection(file, header.observerOffsets, graph.getObserverOffsets(), (size_t)(nodeCount + 1) * sizeof(uint32_t))
+      && writeSection(file, header.observers, graph.getObservers(), (size_t)edgeCount * sizeof(clientId_t));
+
+    if (fclose(file) != 0 || !written) {
+      error = temporary + ": " + strerror(errno);
+      unlink(temporary.c_str());
+      return false;
+    }
+
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+      error = path + ": " + strerror(errno);
+      unlink(temporary.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+ private:
+
+  // Check the header, that every section lies inside the file, and that the
+  // arrays form a graph freeze() could have built: sorted lists without self
+  // edges or duplicates, and an observer index that is exactly the transpose
+  // of the buddy lists.  This reads every page of the file.
+  bool validate(std::string& error) const {
+
+    const GraphFileHeader& header = *header_;
+
+    if (memcmp(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic)) != 0) {
+      error = "not a graph file";
+      return false;
+    }
+
+    if (header.version != GRAPH_FILE_VERSION) {
+      error = "unsupported graph file version";
+      return false;
+    }
+
+    if (header.byteOrder != GRAPH_FILE_BYTE_ORDER) {
+      error = "graph file was written with a different byte order";
+      return false;
+    }
+
+    uint64_t offsetBytes = (uint64_t)(header.nodeCount + 1) * sizeof(uint32_t);
+    uint64_t edgeBytes = (uint64_t)header.edgeCount * sizeof(clientId_t);
+
+    if (header.fileSize != size_
+	|| !fits(header.buddyOffsets, offsetBytes)
+	|| !fits(header.buddies, edgeBytes)
+	|| !fits(header.observerOffsets, offsetBytes)
+	|| !fits(header.observers, edgeBytes)) {
+      error = "truncated or corrupt graph file";
+      return false;
+    }
+
+    const uint32_t* buddyOffsets = section<uint32_t>(header.buddyOffsets);
+    const clientId_t* buddies = section<clientId_t>(header.buddies);
+    const uint32_t* observerOffsets = section<uint32_t>(header.observerOffsets);
+    const clientId_t* observers = section<clientId_t>(header.observers);
+
+    if (!isConsistent(buddyOffsets, buddies) || !isConsistent(observerOffsets, observers)) {
+      error = "corrupt graph file: buddy or observer lists out of range, unsorted or with self edges";
+      return false;
+    }
+
+    // The observer index must be the transpose of the buddy lists.  Walking
+    // the buddy lists in client order visits each client's observers in the
+    // sorted order they are stored in.
+    std::vector<uint32_t> cursor(observerOffsets, observerOffsets + header.nodeCount);
+
+    for (clientId_t i = 0; i < header.nodeCount; i++) {
+      for (uint32_t edge = buddyOffsets[i]; edge != buddyOffsets[i + 1]; edge++) {
+
+	uint32_t& next = cursor[buddies[edge]];
+
+	if (next == observerOffsets[buddies[edge] + 1] || observers[next] != i) {
+	  error = "corrupt graph file: observer index does not match the buddy lists";
+	  return false;
+	}
+
+	next++;
+      }
+    }
+
+    // Every edge was matched, and the lists hold edgeCount observers, so
+    // there are none left over
+    return true;
+  }
+
+  // Whether offsets run from 0 to edgeCount without decreasing, and every
+  // client's list holds other clients in strictly increasing order
+  bool isConsistent(const uint32_t* offsets, const clientId_t* ids) const {
+
+    const GraphFileHeader& header = *header_;
+
+    if (offsets[0] != 0 || offsets[header.nodeCount] != header.edgeCount) {
+      return false;
+    }
+
+    for (clientId_t i = 0; i < header.nodeCount; i++) {
+
+      if (offsets[i + 1] < offsets[i]) {
+	return false;
+      }
+
+      for (uint32_t edge = offsets[i]; edge != offsets[i + 1]; edge++) {
+	if (ids[edge] >= header.nodeCount || ids[edge] == i
+	    || (edge != offsets[i] && ids[edge] <= ids[edge - 1])) {
+	  return false;
+	}
+      }
+    }
+
+    return true;
+  }
+
+  // Whether an aligned section of length bytes at offset lies inside the file
+  inline bool fits(const uint64_t& offset, const uint64_t& length) const {
+    return offset % 64 == 0 && offset >= sizeof(GraphFileHeader) && offset <= size_ && length <= size_ - offset;
+  }
+
+  template<class T>
+  inline const T* section(const uint64_t& offset) const {
+    return reinterpret_cast<const T*>(static_cast<const char*>(data_) + offset);
+  }
+
+  static inline uint64_t align(const uint64_t& offset) {
+    return (offset + 63) & ~(uint64_t)63;
+  }
+
+  // Pad the file out to offset, then write length bytes of data
+  static bool writeSection(FILE* file, const uint64_t& offset, const void* data, const size_t& length) {
+
+    static const char padding[64] = { 0 };
+    long position = ftell(file);
+
+    if (position < 0 || (uint64_t)position > offset
+	|| fwrite(padding, 1, offset - position, file) != offset - position) {
+      return false;
+    }
+
+    return length == 0 || fwrite(data, 1, length, file) == length;
+  }
+
+  void* data_;
+  size_t size_;
+  const GraphFileHeader* header_;
+};
+
+#endif // _GRAPH_FILE_H_
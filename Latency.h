@@ -0,0 +1,150 @@
+/*
+ * Latency.h
+ *
+ * Per-link network latency, in whole simulated seconds
+ *
+ * Every directed link (sender, recipient) has a fixed latency drawn from the
+ * model's distribution.  The draw is a CounterRandom of the link, keyed by a
+ * salted run seed, so it costs no memory per link, never touches a client's
+ * own stream and is the same on every thread.
+ *
+ * Models are given as
+ *
+ *   none                  every message is delivered in the tick it is sent
+ *   constant:<s>          every link takes s seconds
+ *   uniform:<min>:<max>   links take min to max seconds, uniformly
+ *   exponential:<mean>    links take an exponentially distributed time, rounded
+ *                         down and capped at 16 means
+ */
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ClientTypes.h"
+#include "CounterRandom.h"
+
+enum LatencyType {
+  NO_LATENCY,
+  CONSTANT_LATENCY,
+  UNIFORM_LATENCY,
+  EXPONENTIAL_LATENCY
+};
+
+class LatencyModel {
+
+ public:
+  LatencyModel()
+    : type_(NO_LATENCY),
+      min_(0),
+      max_(0),
+      mean_(0)
+  { }
+
+  // Parse a model description.  On failure returns false and sets error.
+  static bool parse(const std::string& spec, LatencyModel& model, std::string& error) {
+
+    unsigned long first = 0;
+    unsigned long second = 0;
+    char trailing = 0;
+
+    model = LatencyModel();
+
+    if (spec == "none") {
+      return true;
+    }
+
+    // Values are checked against the horizon before they are narrowed, so
+    // none can wrap into range
+    if (sscanf(spec.c_str(), "constant:%lu%c", &first, &trailing) == 1) {
+
+      if (first > MAX_HORIZON) {
+	error = "latency is limited to a day";
+	return false;
+      }
+
+      model.type_ = first == 0 ? NO_LATENCY : CONSTANT_LATENCY;
+      model.min_ = model.max_ = first;
+    } else if (sscanf(spec.c_str(), "uniform:%lu:%lu%c", &first, &second, &trailing) == 2 && first <= second) {
+
+      if (second > MAX_HORIZON) {
+	error = "latency is limited to a day";
+	return false;
+      }
+
+      model.type_ = second == 0 ? NO_LATENCY : UNIFORM_LATENCY;
+      model.min_ = first;
+      model.max_ = second;
+    } else if (sscanf(spec.c_str(), "exponential:%lu%c", &first, &trailing) == 1) {
+
+      // Capped at 16 means, which must fit in the horizon
+      if (first > MAX_HORIZON / 16) {
+	error = "exponential latency is capped at 16 means, which is limited to a day";
+	return false;
+      }
+
+      model.type_ = first == 0 ? NO_LATENCY : EXPONENTIAL_LATENCY;
+      model.mean_ = first;
+      model.max_ = first * 16;
+    } else {
+      error = "latency must be none, constant:<s>, uniform:<min>:<max> or exponential:<mean>";
+      return false;
+    }
+
+    return true;
+  }
+
+  // Key the per-link draws to a run's seed
+  inline void setSeed(const uint32_t& seed) {
+    random_ = CounterRandom(seed ^ LINK_SALT);
+  }
+
+  inline LatencyType getType(void) const {
+    return type_;
+  }
+
+  // Longest latency of any link
+  inline uint32_t getHorizon(void) const {
+    return max_;
+  }
+
+  // Latency of the link from sender to recipient
+  inline uint32_t operator()(const clientId_t& sender, const clientId_t& recipient) const {
+
+    switch (type_) {
+
+    case NO_LATENCY:
+      return 0;
+
+    case CONSTANT_LATENCY:
+      return min_;
+
+    case UNIFORM_LATENCY:
+      return min_ + random_(sender, recipient) % (max_ - min_ + 1);
+
+    case EXPONENTIAL_LATENCY: {
+      double uniform = (random_(sender, recipient) + 0.5) / 4294967296.0;
+      double latency = -(double)mean_ * std::log(uniform);
+      return latency < max_ ? (uint32_t)latency : max_;
+    }
+    }
+
+    return 0;
+  }
+
+ private:
+  static const uint32_t LINK_SALT = 0x4C494E4B;
+  static const uint32_t MAX_HORIZON = 60 * 60 * 24;
+
+  LatencyType type_;
+  uint32_t min_;
+  uint32_t max_;
+  uint32_t mean_;
+  CounterRandom random_;
+};
+
+#endif // _LATENCY_H_
@@ -0,0 +1,102 @@
+/*
+ * MessageBatch.h
+ *
+ * The run of a superstep's inbox addressed to one client
+ *
+ * A worker's inbox is sorted by recipient, so each client's messages are
+ * adjacent and a protocol can handle them together, loading the client's
+ * state once.  Messages are lost in the network or refused by the
+ * recipient's receive queue as the batch hands them out, drawing from the
+ * recipient's stream in between the protocol's own draws exactly as
+ * message-at-a-time delivery would, so batching never changes a run.
+ */
+
+#ifndef _MESSAGE_BATCH_H_
+#define _MESSAGE_BATCH_H_
+
+#include "ClientTypes.h"
+#include "ClientTable.h"
+#include "Worker.h"
+#include "Bandwidth.h"
+
+class MessageBatch {
+
+ public:
+  // Inbox messages [begin, end) of worker, which all share a recipient
+  MessageBatch(Worker& worker,
+	       ClientTable& table,
+	       Bandwidth& bandwidth,
+	       const uint32_t& begin,
+	       const uint32_t& end)
+    : worker_(worker),
+      table_(table),
+      bandwidth_(bandwidth),
+      recipient_(worker.getInboxMessage(begin).recipientId),
+      next_(begin),
+      end_(end),
+      dropped_(0)
+  { }
+
+  inline clientId_t getRecipient(void) const {
+    return recipient_;
+  }
+
+  // The next message to handle, or NULL once the batch is exhausted
+  inline const ClientMessage* next(void) {
+
+    while (next_ != end_) {
+
+      const ClientMessage& message = worker_.getInboxMessage(next_++);
+
+      // Drop message with 5% probabilty, decided by the recipient's stream,
+      // then if the recipient's receive queue won't take it
+      if ( (table_.random(recipient_) % 100) < 5 || !(*this).admit() ) {
+	worker_.trace(TRACE_DROP, message.messageType, message.timestamp, message.recipientId, message.senderId);
+	dropped_++;
+      } else {
+	worker_.trace(TRACE_DELIVER, message.messageType, message.timestamp, message.recipientId, message.senderId);
+	return &message;
+      }
+    }
+
+    return NULL;
+  }
+
+  // Exhaust the batch without handling it, as an OFFLINE client does
+  inline void skip(void) {
+    while ((*this).next() != NULL) { }
+  }
+
+  // Messages dropped so far
+  inline uint32_t getDroppedCount(void) const {
+    return dropped_;
+  }
+
+ private:
+
+  // Whether the recipient has room for another message, counting the overflow if not
+  inline bool admit(void) {
+
+    Bandwidth::Admission admission = bandwidth_.admitReceive(recipient_, worker_.getTime(), [this]() {
+	return (*this).table_.random((*this).recipient_);
+      });
+
+    if (admission == Bandwidth::OVERFLOWED) {
+      worker_.getStats().incrementInboundOverflows();
+    } else if (admission == Bandwidth::EARLY_DROPPED) {
+      worker_.getStats().incrementEarlyDrops();
+    }
+
+    return admission == Bandwidth::ADMITTED;
+  }
+
+  Worker& worker_;
+  ClientTable& table_;
+  Bandwidth& bandwidth_;
+  clientId_t recipient_;
+  uint32_t next_;
+  uint32_t end_;
+  uint32_t dropped_;
+};
+
+#endif // _MESSAGE_BATCH_H_
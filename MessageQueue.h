@@ -0,0 +1,109 @@
+/*
+ * MessageQueue.h
+ *
+ * FIFO ring buffer of fixed-size messages for in-memory dispatch
+ *
+ * The buffer only grows, doubling when full, so once it has reached the
+ * largest round's backlog pushing and popping never touch the heap.  Growths
+ * are counted so runs can show that steady-state dispatch is allocation free.
+ */
+
+#ifndef _MESSAGE_QUEUE_H_
+#define _MESSAGE_QUEUE_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "ClientTypes.h"
+
+class MessageQueue {
+
+ public:
+  MessageQueue(const size_t& initialCapacity = 64)
+    : head_(0),
+      size_(0),
+      allocations_(1)
+  {
+    size_t capacity = 1;
+
+    while (capacity < initialCapacity) {
+      capacity *= 2;
+    }
+
+    ring_.resize(capacity);
+  }
+
+  inline void push(const ClientMessage& message) {
+    if (size_ == ring_.size()) {
+      grow();
+    }
+
+    ring_[(head_ + size_) & (ring_.size() - 1)] = message;
+    size_++;
+  }
+
+  inline const ClientMessage& front(void) const {
+    return ring_[head_];
+  }
+
+  // The index'th message from the front
+  inline const ClientMessage& at(const size_t& index) const {
+    return ring_[(head_ + index) & (ring_.size() - 1)];
+  }
+
+  inline ClientMessage& at(const size_t& index) {
+    return ring_[(head_ + index) & (ring_.size() - 1)];
+  }
+
+  inline void pop(void) {
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    size_--;
+  }
+
+  inline bool empty(void) const {
+    return size_ == 0;
+  }
+
+  inline size_t size(void) const {
+    return size_;
+  }
+
+  inline size_t capacity(void) const {
+    return ring_.size();
+  }
+
+  // Exchange contents, buffers and allocation counts with other in O(1)
+  void swap(MessageQueue& other) {
+    ring_.swap(other.ring_);
+    std::swap(head_, other.head_);
+    std::swap(size_, other.size_);
+    std::swap(allocations_, other.allocations_);
+  }
+
+  // Number of times the buffer has been allocated
+  inline size_t getAllocationCount(void) const {
+    return allocations_;
+  }
+
+ private:
+
+  // Double the buffer, unwrapping the queued messages to the front
+  void grow(void) {
+    std::vector<ClientMessage> ring(ring_.size() * 2);
+
+    for (size_t i = 0; i < size_; i++) {
+      ring[i] = ring_[(head_ + i) & (ring_.size() - 1)];
+    }
+
+    ring_.swap(ring);
+    head_ = 0;
+    allocations_++;
+  }
+
+  std::vector<ClientMessage> ring_;
+  size_t head_;
+  size_t size_;
+  size_t allocations_;
+};
+
+#endif // _MESSAGE_QUEUE_H_
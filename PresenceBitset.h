@@ -0,0 +1,201 @@
+/*
+ * PresenceBitset.h
+ *
+ * Client presence packed one bit per entry: set for ONLINE, clear for OFFLINE
+ *
+ * Used both for the population's ground truth (one bit per client) and for
+ * the clients' views of their buddies (one bit per BuddyGraph edge).  Keeping
+ * the views aligned with the graph's buddy array lets accuracy be checked for
+ * the whole population in one pass: gather the ground truth bit of each
+ * edge's buddy, XOR with the view bits and popcount the difference.
+ *
+ * Buddy views are written from several worker threads, each owning a
+ * contiguous range of edges, so a word can straddle two owners.  Reads are
+ * relaxed atomic loads (plain loads on x86) and the *Shared setters update
+ * such boundary words with atomic read-modify-writes.
+ */
+
+#ifndef _PRESENCE_BITSET_H_
+#define _PRESENCE_BITSET_H_
+
+#include <vector>
+
+#include "ClientTypes.h"
+#include "Checkpoint.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+class PresenceBitset {
+
+ public:
+  PresenceBitset(const size_t& size = 0)
+    : size_(size),
+      words_((size + 63) / 64, 0)
+  { }
+
+  void resize(const size_t& size) {
+    size_ = size;
+    words_.assign((size + 63) / 64, 0);
+  }
+
+  inline size_t size(void) const {
+    return size_;
+  }
+
+  inline bool isOnline(const size_t& index) const {
+    return (__atomic_load_n(&words_[index >> 6], __ATOMIC_RELAXED) >> (index & 63)) & 1;
+  }
+
+  inline ClientState getState(const size_t& index) const {
+    return isOnline(index) ? ONLINE : OFFLINE;
+  }
+
+  inline void setState(const size_t& index, const ClientState& state) {
+    if (state == ONLINE) {
+      words_[index >> 6] |= (uint64_t)1 << (index & 63);
+    } else {
+      words_[index >> 6] &= ~((uint64_t)1 << (index & 63));
+    }
+  }
+
+  // setState for a bitset whose words other threads may be writing
+  inline void setStateShared(const size_t& index, const ClientState& state) {
+    uint64_t bit = (uint64_t)1 << (index & 63);
+
+    if (state == ONLINE) {
+      __atomic_fetch_or(&words_[index >> 6], bit, __ATOMIC_RELAXED);
+    } else {
+      __atomic_fetch_and(&words_[index >> 6], ~bit, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Set every entry in [begin, end) to state.  Only the partial words at either
+  // end can be shared with another thread, so only those are updated atomically.
+  void setRangeShared(const size_t& begin, const size_t& end, const ClientState& state) {
+
+    if (begin >= end) {
+      return;
+    }
+
+    size_t first = begin >> 6;
+    size_t last = (end - 1) >> 6;
+    uint64_t firstMask = ~(uint64_t)0 << (begin & 63);
+    uint64_t lastMask = ~(uint64_t)0 >> (63 - ((end - 1) & 63));
+
+    if (first == last) {
+      setMaskShared(first, firstMask & lastMask, state);
+      return;
+    }
+
+    setMaskShared(first, firstMask, state);
+
+    for (size_t word = first + 1; word < last; word++) {
+      words_[word] = state == ONLINE ? ~(uint64_t)0 : 0;
+    }
+
+    setMaskShared(last, lastMask, state);
+  }
+
+  inline const uint64_t* getWords(void) const {
+    return words_.data();
+  }
+
+  inline size_t getWordCount(void) const {
+    return words_.size();
+  }
+
+  // Overwrite entries [64 * word, 64 * word + 64) at once
+  inline void setWord(const size_t& word, const uint64_t& bits) {
+    words_[word] = bits;
+  }
+
+  void save(CheckpointWriter& writer) const {
+    writer.writeVector(words_);
+  }
+
+  // Restore bits saved from a bitset of the same size
+  void restore(CheckpointReader& reader) {
+    reader.readVector(words_);
+  }
+
+  // Number of ONLINE entries
+  size_t countOnline(void) const {
+    size_t count = 0;
+
+    for (size_t i = 0; i < words_.size(); i++) {
+      count += __builtin_popcountll(words_[i]);
+    }
+
+    return count;
+  }
+
+  // Number of edges whose view bit disagrees with the ground truth bit of the
+  // edge's buddy.  views holds one bit per edge and buddies the edges' ids.
+  static size_t countMismatches(const PresenceBitset& truth,
+				const PresenceBitset& views,
+				const clientId_t* buddies) {
+
+    size_t mismatches = 0;
+    size_t edgeCount = views.size();
+    size_t fullWords = edgeCount / 64;
+
+    for (size_t word = 0; word < fullWords; word++) {
+      uint64_t gathered = gatherWord(truth, buddies + word * 64);
+      mismatches += __builtin_popcountll(gathered ^ views.words_[word]);
+    }
+
+    // Trailing partial word
+    for (size_t edge = fullWords * 64; edge < edgeCount; edge++) {
+      mismatches += truth.isOnline(buddies[edge]) != views.isOnline(edge);
+    }
+
+    return mismatches;
+  }
+
+ private:
+
+  inline void setMaskShared(const size_t& word, const uint64_t& mask, const ClientState& state) {
+    if (state == ONLINE) {
+      __atomic_fetch_or(&words_[word], mask, __ATOMIC_RELAXED);
+    } else {
+      __atomic_fetch_and(&words_[word], ~mask, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Ground truth bits of 64 consecutive edges' buddies, packed into one word
+  static inline uint64_t gatherWord(const PresenceBitset& truth, const clientId_t* buddies) {
+
+    uint64_t gathered = 0;
+
+#ifdef __AVX2__
+    // Gather the 32 bit word holding each buddy's bit, shift that bit up to
+    // the sign position and collect 8 sign bits at a time
+    const int* base = reinterpret_cast<const int*>(truth.words_.data());
+    const __m256i low = _mm256_set1_epi32(31);
+
+    for (uint32_t lane = 0; lane < 64; lane += 8) {
+      __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buddies + lane));
+      __m256i words = _mm256_i32gather_epi32(base, _mm256_srli_epi32(ids, 5), 4);
+      __m256i bits = _mm256_sllv_epi32(words, _mm256_sub_epi32(low, _mm256_and_si256(ids, low)));
+      uint64_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(bits));
+      gathered |= mask << lane;
+    }
+#else
+    const uint64_t* words = truth.words_.data();
+
+    for (uint32_t lane = 0; lane < 64; lane++) {
+      clientId_t id = buddies[lane];
+      gathered |= ((words[id >> 6] >> (id & 63)) & 1) << lane;
+    }
+#endif
+
+    return gathered;
+  }
+
+  size_t size_;
+  std::vector<uint64_t> words_;
+};
+
+#endif // _PRESENCE_BITSET_H_
@@ -1,116 +1,249 @@
 #ifndef _STATS_H_
 #define _STATS_H_
 
+/*
+ * Counters are accumulated in one StatShard per worker thread, each on its
+ * own cache line so the workers never write to a shared line, and summed
+ * when they are read.  Accumulators are 64 bit: message counts and summed
+ * convergence times overflow 32 bits on long runs over large populations.
+ *
+ * Each client's last state switch is kept in dense arrays indexed by
+ * clientId, so the convergence-time lookup is a single load.
+ */
+
+#include <vector>
+
 #include "ClientTypes.h"
+#include "PresenceBitset.h"
+#include "Checkpoint.h"
 
-class SimulatorStatistics {
+class alignas(64) StatShard {
 
  public:
-  SimulatorStatistics() {
-    totalConvergenceTime_ = 0;
-    totalPresenceUpdates_ = 0;
-    totalMessagesSent_ = 0;
-    totalDroppedMessages_ = 0;
-    totalBuddyRecords_ = 0;
-    totalCorrectBuddyRecords_ = 0;
-    totalSleepTime_ = 0;
-  }
-
-  void addConvergenceTime(const uint32_t& t) {
+  StatShard()
+    : totalConvergenceTime_(0),
+      totalPresenceUpdates_(0),
+      totalMessagesSent_(0),
+      totalDroppedMessages_(0),
+      totalBuddyRecords_(0),
+      totalCorrectBuddyRecords_(0),
+      totalSleepTime_(0),
+      totalSleepStates_(0),
+      totalInboundOverflows_(0),
+      totalEarlyDrops_(0),
+      totalOutboundOverflows_(0)
+  { }
+
+  inline void addConvergenceTime(const uint64_t& t) {
     totalConvergenceTime_ += t;
   }
 
-  void addSleepTime(const uint32_t& t) {
+  inline void addSleepTime(const uint64_t& t) {
     totalSleepTime_ += t;
   }
 
-  void incrementSleepStates() {
-    totalSleepStates_ ++;
+  inline void incrementSleepStates(void) {
+    totalSleepStates_++;
   }
 
-  void incrementPresenceUpdates(void) {
+  inline void incrementPresenceUpdates(void) {
     totalPresenceUpdates_++;
   }
 
-  void incrementMessagesSent(void) {
+  // "count" presence updates that took convergenceTime to converge in total
+  inline void addPresenceUpdates(const uint64_t& count, const uint64_t& convergenceTime) {
+    totalPresenceUpdates_ += count;
+    totalConvergenceTime_ += convergenceTime;
+  }
+
+  inline void incrementMessagesSent(void) {
     totalMessagesSent_++;
   }
 
-  void incrementMessagesDropped(void) {
+  inline void addMessagesSent(const uint64_t& count) {
+    totalMessagesSent_ += count;
+  }
+
+  inline void incrementMessagesDropped(void) {
     totalDroppedMessages_++;
   }
 
-  void incrementTotalBuddyRecords(void) {
-    totalBuddyRecords_++;
+  inline void addMessagesDropped(const uint64_t& count) {
+    totalDroppedMessages_ += count;
+  }
+
+  inline void incrementInboundOverflows(void) {
+    totalInboundOverflows_++;
+  }
+
+  inline void incrementEarlyDrops(void) {
+    totalEarlyDrops_++;
+  }
+
+  inline void incrementOutboundOverflows(void) {
+    totalOutboundOverflows_++;
+  }
+
+  inline void addTotalBuddyRecords(const uint64_t& count) {
+    totalBuddyRecords_ += count;
   }
 
-  void incrementTotalCorrectBuddyRecords(void) {
-    totalCorrectBuddyRecords_++;
+  inline void addTotalCorrectBuddyRecords(const uint64_t& count) {
+    totalCorrectBuddyRecords_ += count;
   }
 
-  void addStateSwitch(const clientId_t& clientId, 
-		      const uint32_t& timestamp, 
-		      const ClientState& state) {
+ private:
+  friend class SimulatorStatistics;
+
+  uint64_t totalConvergenceTime_;
+  uint64_t totalPresenceUpdates_;
+  uint64_t totalMessagesSent_;
+  uint64_t totalDroppedMessages_;
+  uint64_t totalBuddyRecords_;
+  uint64_t totalCorrectBuddyRecords_;
+  uint64_t totalSleepTime_;
+  uint64_t totalSleepStates_;
+  uint64_t totalInboundOverflows_;
+  uint64_t totalEarlyDrops_;
+  uint64_t totalOutboundOverflows_;
+};
+
+class SimulatorStatistics {
+
+ public:
+  SimulatorStatistics(const uint32_t& nodeCount, const uint32_t& shardCount = 1)
+    : shards_(shardCount),
+      stateSwitches_(nodeCount, 0),
+      state_(nodeCount)
+  { }
+
+  // Counters written by worker "index".  Work done on the event loop's thread counts as worker 0's.
+  inline StatShard& getShard(const uint32_t& index) {
+    return shards_[index];
+  }
+
+  inline void addStateSwitch(const clientId_t& clientId, 
+			     const uint32_t& timestamp, 
+			     const ClientState& state) {
     stateSwitches_[clientId] = timestamp;
-    state_[clientId] = state;
+    state_.setState(clientId, state);
   }
 
-  uint32_t getLastStateSwitch(const clientId_t& clientId) {
-    if (stateSwitches_.find(clientId) == stateSwitches_.end()) {
-      stateSwitches_[clientId] = 0;
-    }
-    
+  // Time of clientId's last state switch, 0 if it has never switched
+  inline uint32_t getLastStateSwitch(const clientId_t& clientId) const {
     return stateSwitches_[clientId];
   }
 
-  inline ClientState getLastState(const clientId_t& clientId) {    
-    return state_[clientId];
+  inline ClientState getLastState(const clientId_t& clientId) const {
+    return state_.getState(clientId);
   }
 
-  inline uint32_t getPresenceUpdatesCount(void) const {
-    return totalPresenceUpdates_;
+  inline uint64_t getPresenceUpdatesCount(void) const {
+    return sum(&StatShard::totalPresenceUpdates_);
   }
 
-  inline uint32_t getTotalConvergenceTime(void) const {
-    return totalConvergenceTime_;
+  inline uint64_t getTotalConvergenceTime(void) const {
+    return sum(&StatShard::totalConvergenceTime_);
   }
 
-  inline uint32_t getTotalMessagesSentCount(void) const {
-    return totalMessagesSent_;
+  inline uint64_t getTotalMessagesSentCount(void) const {
+    return sum(&StatShard::totalMessagesSent_);
   }
 
-  inline uint32_t getTotalMessagesDroppedCount(void) const {
-    return totalDroppedMessages_;
+  inline uint64_t getTotalMessagesDroppedCount(void) const {
+    return sum(&StatShard::totalDroppedMessages_);
   }
 
-  inline uint32_t getTotalBuddyRecords(void) const {
-    return totalBuddyRecords_;
+  inline uint64_t getTotalBuddyRecords(void) const {
+    return sum(&StatShard::totalBuddyRecords_);
   }
 
-  inline uint32_t getTotalCorrectBuddyRecords(void) const {
-    return totalCorrectBuddyRecords_;
+  inline uint64_t getTotalCorrectBuddyRecords(void) const {
+    return sum(&StatShard::totalCorrectBuddyRecords_);
   }
 
-  inline uint32_t getTotalSleepTime(void) const {
-    return totalSleepTime_;
+  inline uint64_t getTotalSleepTime(void) const {
+    return sum(&StatShard::totalSleepTime_);
   }
 
-  inline uint32_t getTotalSleepStates(void) const {
-    return totalSleepStates_;
+  inline uint64_t getTotalSleepStates(void) const {
+    return sum(&StatShard::totalSleepStates_);
+  }
+
+  // Messages dropped at a full receive queue, early by RANDOM_EARLY_DROP,
+  // and suppressed by their sender's outbound budget
+  inline uint64_t getTotalInboundOverflows(void) const {
+    return sum(&StatShard::totalInboundOverflows_);
+  }
+
+  inline uint64_t getTotalEarlyDrops(void) const {
+    return sum(&StatShard::totalEarlyDrops_);
+  }
+
+  inline uint64_t getTotalOutboundOverflows(void) const {
+    return sum(&StatShard::totalOutboundOverflows_);
+  }
+
+ // Counters are saved merged, so a checkpoint can be restored at any thread count
+  void save(CheckpointWriter& writer) const {
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+      writer.write(sum(COUNTERS[i]));
+    }
+
+    writer.writeVector(stateSwitches_);
+    state_.save(writer);
+  }
+
+  // Restore merged counters into shard 0
+  void restore(CheckpointReader& reader) {
+    for (size_t i = 0; i < shards_.size(); i++) {
+      shards_[i] = StatShard();
+    }
+
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+      reader.read(shards_[0].*COUNTERS[i]);
+    }
+
+    reader.readVector(stateSwitches_);
+    state_.restore(reader);
   }
 
  private:
-  uint32_t totalConvergenceTime_;
-  uint32_t totalPresenceUpdates_;
-  uint32_t totalMessagesSent_;
-  uint32_t totalDroppedMessages_;
-  uint32_t totalBuddyRecords_;
-  uint32_t totalCorrectBuddyRecords_;
-  uint32_t totalSleepTime_;
-  uint32_t totalSleepStates_;
-
-  std::hash_map<clientId_t, uint32_t> stateSwitches_;
-  std::hash_map<clientId_t, ClientState> state_;
+
+  static const size_t COUNTER_COUNT = 11;
+  static uint64_t StatShard::* const COUNTERS[COUNTER_COUNT];
+
+  // A counter merged across every shard
+  uint64_t sum(uint64_t StatShard::* counter) const {
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < shards_.size(); i++) {
+      total += shards_[i].*counter;
+    }
+
+    return total;
+  }
+
+  std::vector<StatShard> shards_;
+
+  // Indexed by clientId
+  std::vector<uint32_t> stateSwitches_;
+  PresenceBitset state_;
+};
+
+// Every StatShard counter, in checkpoint order
+inline uint64_t StatShard::* const SimulatorStatistics::COUNTERS[SimulatorStatistics::COUNTER_COUNT] = {
+  &StatShard::totalConvergenceTime_,
+  &StatShard::totalPresenceUpdates_,
+  &StatShard::totalMessagesSent_,
+  &StatShard::totalDroppedMessages_,
+  &StatShard::totalBuddyRecords_,
+  &StatShard::totalCorrectBuddyRecords_,
+  &StatShard::totalSleepTime_,
+  &StatShard::totalSleepStates_,
+  &StatShard::totalInboundOverflows_,
+  &StatShard::totalEarlyDrops_,
+  &StatShard::totalOutboundOverflows_
 };
 
 #endif // _STATS_H_
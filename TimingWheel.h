@@ -0,0 +1,316 @@
+/*
+ * TimingWheel.h
+ *
+ * Hierarchical timing wheel used for client wakeups
+ *
+ * Four levels of 256 slots cover the full 32 bit range of simulated seconds.
+ * An entry lives on the lowest level at which its expiry time and the wheel's
+ * current time still differ, and is cascaded down one or more levels as the
+ * wheel's time reaches its block.  Slots are intrusive doubly-linked lists
+ * threaded through a per-client entry table, so scheduling, cancelling and
+ * expiring are O(1) and never allocate.
+ */
+
+#ifndef _TIMING_WHEEL_H_
+#define _TIMING_WHEEL_H_
+
+#include <vector>
+
+#include "ClientTypes.h"
+#include "Checkpoint.h"
+
+class TimingWheel {
+
+ public:
+  // Returned by nextExpiry() when nothing is pending
+  static const uint32_t NIL = 0xFFFFFFFF;
+
+  TimingWheel(const uint32_t& capacity)
+    : now_(0),
+      pending_(0),
+      entries_(capacity)
+  {
+    for (uint32_t i = 0; i < SLOT_COUNT; i++) {
+      heads_[i] = NIL;
+    }
+
+    for (uint32_t level = 0; level < LEVELS; level++) {
+      for (uint32_t word = 0; word < BITMAP_WORDS; word++) {
+	occupied_[level][word] = 0;
+      }
+    }
+  }
+
+  // Schedule (or reschedule) a client to expire at "when".  Times that have
+  // already passed are due on the next call to advance()
+  void schedule(const clientId_t& clientId, uint32_t when) {
+
+    if (entries_[clientId].slot != UNSCHEDULED) {
+      unlink(clientId);
+      pending_--;
+    }
+
+    if (when < now_) {
+      when = now_;
+    }
+
+    entries_[clientId].when = when;
+    place(clientId);
+    pending_++;
+  }
+
+  void cancel(const clientId_t& clientId) {
+    if (entries_[clientId].slot == UNSCHEDULED) {
+      return;
+    }
+
+    unlink(clientId);
+    pending_--;
+  }
+
+  // Expire every entry due at or before "timestamp", in expiry order, calling
+  // handler(clientId, expiryTime) for each.  The handler may freely schedule
+  // or cancel entries, including the one being expired.
+  template<class Handler>
+  void advance(const uint32_t& timestamp, Handler handler) {
+
+    for (;;) {
+      uint32_t next = nextExpiry();
+
+      if (next == NIL || next > timestamp) {
+	break;
+      }
+
+      jumpTo(next);
+
+      // Move the due slot onto the expiry list so handlers can't disturb the walk
+      uint32_t slot = next & SLOT_MASK;
+      uint32_t clientId = heads_[slot];
+
+      heads_[slot] = NIL;
+      clearOccupied(0, slot);
+      heads_[EXPIRING] = clientId;
+
+      for (; clientId != NIL; clientId = entries_[clientId].next) {
+	entries_[clientId].slot = EXPIRING;
+      }
+
+      while (heads_[EXPIRING] != NIL) {
+	clientId = heads_[EXPIRING];
+	unlink(clientId);
+	pending_--;
+	handler(clientId, next);
+      }
+    }
+
+    if (now_ <= timestamp) {
+      jumpTo(timestamp + 1);
+    }
+  }
+
+  // The earliest pending expiry time, or NIL if nothing is pending
+  uint32_t nextExpiry(void) const {
+
+    if (pending_ == 0) {
+      return NIL;
+    }
+
+    // Level 0 slots hold exact expiry times within the current block
+    uint32_t slot = findOccupied(0, now_ & SLOT_MASK);
+
+    if (slot != NIL) {
+      return (now_ & ~SLOT_MASK) | slot;
+    }
+
+    // Higher levels are coarser, so find the earliest entry in the next occupied slot
+    for (uint32_t level = 1; level < LEVELS; level++) {
+
+      slot = findOccupied(level, ((now_ >> (level * LEVEL_BITS)) & SLOT_MASK) + 1);
+
+      if (slot == NIL) {
+	continue;
+      }
+
+      uint32_t earliest = NIL;
+
+      for (uint32_t i = heads_[level * SLOTS + slot]; i != NIL; i = entries_[i].next) {
+	if (entries_[i].when < earliest) {
+	  earliest = entries_[i].when;
+	}
+      }
+
+      return earliest;
+    }
+
+    return NIL;
+  }
+
+  inline bool isScheduled(const clientId_t& clientId) const {
+    return entries_[clientId].slot != UNSCHEDULED;
+  }
+
+  inline uint32_t getExpiry(const clientId_t& clientId) const {
+    return entries_[clientId].when;
+  }
+
+  inline uint32_t getPendingCount(void) const {
+    return pending_;
+  }
+
+  inline uint32_t getTime(void) const {
+    return now_;
+  }
+
+  // The wheel is saved exactly as laid out, so a restored wheel expires
+  // entries in the same order as the original would have
+  void save(CheckpointWriter& writer) const {
+    writer.write(now_);
+    writer.write(pending_);
+    writer.writeArray(heads_, SLOT_COUNT);
+    writer.writeArray(&occupied_[0][0], LEVELS * BITMAP_WORDS);
+    writer.writeVector(entries_);
+  }
+
+  void restore(CheckpointReader& reader) {
+    reader.read(now_);
+    reader.read(pending_);
+    reader.readArray(heads_, SLOT_COUNT);
+    reader.readArray(&occupied_[0][0], LEVELS * BITMAP_WORDS);
+    reader.readVector(entries_);
+  }
+
+ private:
+
+  static const uint32_t LEVELS = 4;
+  static const uint32_t LEVEL_BITS = 8;
+  static const uint32_t SLOTS = 1 << LEVEL_BITS;
+  static const uint32_t SLOT_MASK = SLOTS - 1;
+  static const uint32_t BITMAP_WORDS = SLOTS / 64;
+
+  // Wheel slots, followed by the list of entries currently being expired
+  static const uint32_t EXPIRING = LEVELS * SLOTS;
+  static const uint32_t SLOT_COUNT = EXPIRING + 1;
+  static const uint16_t UNSCHEDULED = 0xFFFF;
+
+  struct Entry {
+    Entry() : next(NIL), prev(NIL), when(0), slot(UNSCHEDULED) { }
+
+    uint32_t next;
+    uint32_t prev;
+    uint32_t when;
+    uint16_t slot;
+  };
+
+  // Link an entry into the slot matching its expiry relative to now_
+  void place(const clientId_t& clientId) {
+
+    uint32_t when = entries_[clientId].when;
+    uint32_t diff = when ^ now_;
+    uint32_t level = 0;
+
+    while (level < LEVELS - 1 && (diff >> ((level + 1) * LEVEL_BITS)) != 0) {
+      level++;
+    }
+
+    uint32_t slot = (when >> (level * LEVEL_BITS)) & SLOT_MASK;
+    uint32_t head = level * SLOTS + slot;
+
+    entries_[clientId].slot = head;
+    entries_[clientId].prev = NIL;
+    entries_[clientId].next = heads_[head];
+
+    if (heads_[head] != NIL) {
+      entries_[heads_[head]].prev = clientId;
+    }
+
+    heads_[head] = clientId;
+    setOccupied(level, slot);
+  }
+
+  void unlink(const clientId_t& clientId) {
+
+    Entry& entry = entries_[clientId];
+
+    if (entry.prev != NIL) {
+      entries_[entry.prev].next = entry.next;
+    } else {
+      heads_[entry.slot] = entry.next;
+
+      if (entry.next == NIL && entry.slot != EXPIRING) {
+	clearOccupied(entry.slot / SLOTS, entry.slot % SLOTS);
+      }
+    }
+
+    if (entry.next != NIL) {
+      entries_[entry.next].prev = entry.prev;
+    }
+
+    entry.next = NIL;
+    entry.prev = NIL;
+    entry.slot = UNSCHEDULED;
+  }
+
+  // Move the wheel's time forward to "timestamp".  Nothing may be due before
+  // it, so only the slots covering "timestamp" itself need to be cascaded.
+  void jumpTo(const uint32_t& timestamp) {
+
+    now_ = timestamp;
+
+    for (uint32_t level = LEVELS - 1; level > 0; level--) {
+
+      uint32_t slot = (now_ >> (level * LEVEL_BITS)) & SLOT_MASK;
+      uint32_t head = level * SLOTS + slot;
+      uint32_t clientId = heads_[head];
+
+      if (clientId == NIL) {
+	continue;
+      }
+
+      heads_[head] = NIL;
+      clearOccupied(level, slot);
+
+      while (clientId != NIL) {
+	uint32_t next = entries_[clientId].next;
+	place(clientId);
+	clientId = next;
+      }
+    }
+  }
+
+  inline void setOccupied(const uint32_t& level, const uint32_t& slot) {
+    occupied_[level][slot >> 6] |= (uint64_t)1 << (slot & 63);
+  }
+
+  inline void clearOccupied(const uint32_t& level, const uint32_t& slot) {
+    occupied_[level][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+  }
+
+  // First occupied slot at or after "from" on the given level, or NIL
+  uint32_t findOccupied(const uint32_t& level, const uint32_t& from) const {
+
+    for (uint32_t word = from >> 6; word < BITMAP_WORDS; word++) {
+
+      uint64_t bits = occupied_[level][word];
+
+      if (word == (from >> 6)) {
+	bits &= ~(uint64_t)0 << (from & 63);
+      }
+
+      if (bits != 0) {
+	return word * 64 + __builtin_ctzll(bits);
+      }
+    }
+
+    return NIL;
+  }
+
+  uint32_t now_;
+  uint32_t pending_;
+
+  uint32_t heads_[SLOT_COUNT];
+  uint64_t occupied_[LEVELS][BITMAP_WORDS];
+
+  std::vector<Entry> entries_;
+};
+
+#endif // _TIMING_WHEEL_H_
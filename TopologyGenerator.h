@@ -0,0 +1,298 @@
+/*
+ * TopologyGenerator.h
+ *
+ * Pluggable generators for the buddy graph, with four implementations provided
+ *
+ * UniformTopology
+ *  - Every client gets exactly buddyCount buddies, drawn uniformly at random.
+ *
+ * PowerLawTopology
+ *  - Chung-Lu graph.  Every client draws a Pareto distributed weight with mean
+ *    buddyCount, has about that many buddies, and is picked as a buddy in
+ *    proportion to it, so both buddy and observer counts are heavy-tailed and
+ *    a few clients are observed by a large part of the population.
+ *
+ * SmallWorldTopology
+ *  - Watts-Strogatz graph.  Clients sit on a ring, their buddies are their
+ *    nearest neighbours, and each buddy edge is rewired to a random client
+ *    with a small probability, giving high clustering and short paths.
+ *
+ * CommunityTopology
+ *  - Planted partition graph.  Clients are grouped into consecutive blocks,
+ *    and most of a client's buddies are drawn from its own block.
+ *
+ * A generator streams each client's buddies straight into its slice of the
+ * BuddyGraph's CSR array.  getDegree() sizes the slices, then generate() fills
+ * them, for every client in parallel, drawing from that client's random
+ * stream.  Self edges and duplicates may be generated: the graph drops them
+ * when it is frozen.
+ */
+
+#ifndef _TOPOLOGY_GENERATOR_H_
+#define _TOPOLOGY_GENERATOR_H_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "ClientTypes.h"
+#include "ClientTable.h"
+
+class TopologyGenerator {
+
+ public:
+  TopologyGenerator(const uint32_t& nodeCount, const uint32_t& buddyCount)
+    : nodeCount_(nodeCount),
+      buddyCount_(buddyCount)
+  { }
+
+  virtual ~TopologyGenerator() { }
+
+  // Called once, on the event loop's thread, before any other call
+  virtual void prepare(ClientTable& table) { }
+
+  // Number of buddies generate() writes for clientId
+  virtual uint32_t getDegree(const clientId_t& clientId) const = 0;
+
+  // Write clientId's getDegree(clientId) buddies to buddies
+  virtual void generate(const clientId_t& clientId, ClientTable& table, clientId_t* buddies) = 0;
+
+  static TopologyGenerator* create(const TopologyType& topology, const uint32_t& nodeCount, const uint32_t& buddyCount);
+
+ protected:
+
+  // Uniform random number in [0, 1) from clientId's stream
+  static inline double uniform(ClientTable& table, const clientId_t& clientId) {
+    return table.random(clientId) * (1.0 / 4294967296.0);
+  }
+
+  // Write "count" distinct clients drawn uniformly from [begin, begin + size),
+  // other than "exclude", using Floyd's algorithm to sample without replacement
+  static void sampleDistinct(ClientTable& table, const clientId_t& clientId,
+			     const clientId_t& begin, const uint32_t& size, const clientId_t& exclude,
+			     const uint32_t& count, clientId_t* buddies) {
+
+    bool skip = exclude >= begin && exclude < begin + size;
+    uint32_t candidates = size - skip;
+
+    for (uint32_t n = candidates - count, chosen = 0; n < candidates; n++, chosen++) {
+
+      clientId_t pick = begin + table.random(clientId) % (n + 1);
+
+      // Sampled ids skip over the excluded client
+      pick += skip && pick >= exclude;
+
+      // On a repeat take n itself, which can't have been picked yet
+      if (std::find(buddies, buddies + chosen, pick) != buddies + chosen) {
+	pick = begin + n + (skip && begin + n >= exclude);
+      }
+
+      buddies[chosen] = pick;
+    }
+  }
+
+  uint32_t nodeCount_;
+  uint32_t buddyCount_;
+};
+
+
+class UniformTopology : public TopologyGenerator {
+
+ public:
+  UniformTopology(const uint32_t& nodeCount, const uint32_t& buddyCount)
+    : TopologyGenerator(nodeCount, buddyCount)
+  { }
+
+  virtual uint32_t getDegree(const clientId_t& clientId) const {
+    return buddyCount_;
+  }
+
+  virtual void generate(const clientId_t& clientId, ClientTable& table, clientId_t* buddies) {
+    sampleDistinct(table, clientId, 0, nodeCount_, clientId, buddyCount_, buddies);
+  }
+};
+
+
+class PowerLawTopology : public TopologyGenerator {
+
+ public:
+  PowerLawTopology(const uint32_t& nodeCount, const uint32_t& buddyCount, const double& exponent = 2.5)
+    : TopologyGenerator(nodeCount, buddyCount),
+      exponent_(exponent),
+      degrees_(nodeCount),
+      probability_(nodeCount),
+      alias_(nodeCount)
+  { }
+
+  // Draw every client's weight and build an alias table to pick buddies by weight
+  virtual void prepare(ClientTable& table) {
+
+    // Pareto weights with minimum chosen for a mean of buddyCount
+    double minimum = buddyCount_ * (exponent_ - 2) / (exponent_ - 1);
+    std::vector<double> weights(nodeCount_);
+    double total = 0;
+
+    for (clientId_t i = 0; i < nodeCount_; i++) {
+      weights[i] = std::min(minimum * std::pow(1.0 - uniform(table, i), -1.0 / (exponent_ - 1)), (double)(nodeCount_ - 1));
+      degrees_[i] = std::max((uint32_t)std::lround(weights[i]), (uint32_t)1);
+      total += weights[i];
+    }
+
+    // Vose's alias method: split the weights into nodeCount_ equal columns,
+    // each shared by at most two clients
+    std::vector<clientId_t> small;
+    std::vector<clientId_t> large;
+    std::vector<double> scaled(nodeCount_);
+
+    for (clientId_t i = 0; i < nodeCount_; i++) {
+      scaled[i] = weights[i] * nodeCount_ / total;
+      (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+
+      clientId_t under = small.back();
+      clientId_t over = large.back();
+      small.pop_back();
+
+      probability_[under] = scaled[under];
+      alias_[under] = over;
+
+      scaled[over] -= 1.0 - scaled[under];
+
+      if (scaled[over] < 1.0) {
+	large.pop_back();
+	small.push_back(over);
+      }
+    }
+
+    // Whatever is left over fills its column exactly, up to rounding
+    for (size_t i = 0; i < small.size(); i++) {
+      probability_[small[i]] = 1.0;
+    }
+
+    for (size_t i = 0; i < large.size(); i++) {
+      probability_[large[i]] = 1.0;
+    }
+  }
+
+  virtual uint32_t getDegree(const clientId_t& clientId) const {
+    return degrees_[clientId];
+  }
+
+  virtual void generate(const clientId_t& clientId, ClientTable& table, clientId_t* buddies) {
+    for (uint32_t i = 0; i < degrees_[clientId]; i++) {
+      clientId_t column = table.random(clientId) % nodeCount_;
+      buddies[i] = uniform(table, clientId) < probability_[column] ? column : alias_[column];
+    }
+  }
+
+ private:
+  double exponent_;
+
+  std::vector<uint32_t> degrees_;
+
+  // Alias table: column i picks client i with probability_[i], else alias_[i]
+  std::vector<double> probability_;
+  std::vector<clientId_t> alias_;
+};
+
+
+class SmallWorldTopology : public TopologyGenerator {
+
+ public:
+  SmallWorldTopology(const uint32_t& nodeCount, const uint32_t& buddyCount, const double& rewiring = 0.1)
+    : TopologyGenerator(nodeCount, buddyCount),
+      rewiring_(rewiring)
+  { }
+
+  virtual uint32_t getDegree(const clientId_t& clientId) const {
+    return buddyCount_;
+  }
+
+  // Neighbours alternate sides of the ring: +1, -1, +2, -2, ...
+  virtual void generate(const clientId_t& clientId, ClientTable& table, clientId_t* buddies) {
+    for (uint32_t i = 0; i < buddyCount_; i++) {
+
+      uint32_t distance = i / 2 + 1;
+
+      if (uniform(table, clientId) < rewiring_) {
+	buddies[i] = table.random(clientId) % nodeCount_;
+      } else if (i % 2 == 0) {
+	buddies[i] = (clientId + distance) % nodeCount_;
+      } else {
+	buddies[i] = (clientId + nodeCount_ - distance % nodeCount_) % nodeCount_;
+      }
+    }
+  }
+
+ private:
+  double rewiring_;
+};
+
+
+class CommunityTopology : public TopologyGenerator {
+
+ public:
+  CommunityTopology(const uint32_t& nodeCount, const uint32_t& buddyCount,
+		    const uint32_t& communitySize = 100, const double& inside = 0.9)
+    : TopologyGenerator(nodeCount, buddyCount),
+      communitySize_(std::max(communitySize, buddyCount + 1)),
+      inside_(inside)
+  { }
+
+  virtual uint32_t getDegree(const clientId_t& clientId) const {
+    return buddyCount_;
+  }
+
+  virtual void generate(const clientId_t& clientId, ClientTable& table, clientId_t* buddies) {
+
+    clientId_t begin = clientId / communitySize_ * communitySize_;
+    uint32_t size = std::min(communitySize_, nodeCount_ - begin);
+
+    // The last community can be too small to hold every buddy
+    uint32_t insideCount = 0;
+
+    for (uint32_t i = 0; i < buddyCount_; i++) {
+      insideCount += uniform(table, clientId) < inside_;
+    }
+
+    insideCount = std::min(insideCount, size - 1);
+    sampleDistinct(table, clientId, begin, size, clientId, insideCount, buddies);
+
+    // The rest come from outside the community, if there is an outside
+    for (uint32_t i = insideCount; i < buddyCount_; i++) {
+
+      if (size == nodeCount_) {
+	buddies[i] = table.random(clientId) % nodeCount_;
+	continue;
+      }
+
+      clientId_t pick = table.random(clientId) % (nodeCount_ - size);
+      buddies[i] = pick < begin ? pick : pick + size;
+    }
+  }
+
+ private:
+  uint32_t communitySize_;
+  double inside_;
+};
+
+
+inline TopologyGenerator* TopologyGenerator::create(const TopologyType& topology,
+						    const uint32_t& nodeCount,
+						    const uint32_t& buddyCount) {
+  switch (topology) {
+  case POWER_LAW:
+    return new PowerLawTopology(nodeCount, buddyCount);
+  case SMALL_WORLD:
+    return new SmallWorldTopology(nodeCount, buddyCount);
+  case COMMUNITY:
+    return new CommunityTopology(nodeCount, buddyCount);
+  case UNIFORM:
+  default:
+    return new UniformTopology(nodeCount, buddyCount);
+  }
+}
+
+#endif // _TOPOLOGY_GENERATOR_H_
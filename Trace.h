@@ -0,0 +1,246 @@
+/*
+ * Trace.h
+ *
+ * Binary trace of the events of a run, written by a background thread
+ *
+ * A trace file is a 16 byte header followed by fixed width 12 byte
+ * TraceRecords: every message sent, dropped and delivered and every client
+ * state switch.  Each worker thread records into its own stripe of the
+ * TraceWriter, which is double buffered.  When a stripe's active buffer
+ * fills, it is swapped with the stripe's spare and handed to the writer
+ * thread, so recording never waits on the disk unless the writer has fallen
+ * a whole buffer behind.
+ *
+ * Buffers from different stripes are written in the order they fill, so
+ * records of events in the same superstep from different workers interleave
+ * in chunks.  Each record carries its simulated time, for anything that
+ * needs a total order.
+ *
+ * Tracing is compiled in unless SIMULATOR_NO_TRACE is defined, in which case
+ * the recording hooks compile to nothing.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "ClientTypes.h"
+
+enum TraceEvent {
+  TRACE_SEND,
+  TRACE_DROP,
+  TRACE_DELIVER,
+  TRACE_SWITCH
+};
+
+// kind packs the simulated time into its top 28 bits, then the TraceEvent in
+// two bits and its detail in the bottom two: the ClientMessageType, or for
+// switches the new ClientState.  For sends clientId is the sender and peerId
+// the recipient, for drops and deliveries the other way round, and for
+// switches peerId is the switching client again.
+struct TraceRecord {
+  uint32_t kind;
+  clientId_t clientId;
+  clientId_t peerId;
+};
+
+// Records hold simulated times below this, so a traced run must end before it
+static const uint32_t MAX_TRACE_TIME = 1u << 28;
+
+static const char TRACE_MAGIC[8] = { 'S', 'I', 'M', 'T', 'R', 'A', 'C', 'E' };
+static const uint32_t TRACE_VERSION = 1;
+
+class TraceWriter {
+
+ public:
+  TraceWriter(const uint32_t& stripeCount, const size_t& bufferRecords = 1 << 16)
+    : bufferRecords_(bufferRecords),
+      stripes_(stripeCount),
+      file_(NULL),
+      failed_(false),
+      stopping_(false),
+      recordCount_(0)
+  {
+    for (uint32_t i = 0; i < stripeCount; i++) {
+      stripes_[i].active.resize(bufferRecords_);
+      stripes_[i].spare.resize(bufferRecords_);
+    }
+  }
+
+  ~TraceWriter() {
+    std::string error;
+    (*this).close(error);
+  }
+
+  // Start tracing to path.  On failure returns false and sets error.
+  bool open(const std::string& path, std::string& error) {
+
+    file_ = fopen(path.c_str(), "wb");
+
+    if (file_ == NULL) {
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    uint32_t header[2] = { TRACE_VERSION, sizeof(TraceRecord) };
+
+    if (fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file_) != sizeof(TRACE_MAGIC)
+	|| fwrite(header, 1, sizeof(header), file_) != sizeof(header)) {
+      error = path + ": " + strerror(errno);
+      return false;
+    }
+
+    thread_ = std::thread(&TraceWriter::loop, this);
+    return true;
+  }
+
+  // Record an event from the thread owning stripe
+  inline void record(const uint32_t& stripe,
+		     const TraceEvent& event,
+		     const uint8_t& detail,
+		     const uint32_t& timestamp,
+		     const clientId_t& clientId,
+		     const clientId_t& peerId) {
+
+    Stripe& buffers = stripes_[stripe];
+    TraceRecord& record = buffers.active[buffers.used];
+
+    record.kind = timestamp << 4 | event << 2 | detail;
+    record.clientId = clientId;
+    record.peerId = peerId;
+
+    if (++buffers.used == bufferRecords_) {
+      (*this).submit(stripe);
+    }
+  }
+
+  // Write out every stripe's records and stop the writer thread.  Only call
+  // once no worker is recording.
+  bool close(std::string& error) {
+
+    if (file_ == NULL) {
+      return true;
+    }
+
+    if (thread_.joinable()) {
+
+      for (uint32_t i = 0; i < stripes_.size(); i++) {
+	if (stripes_[i].used != 0) {
+	  (*this).submit(i);
+	}
+      }
+
+      {
+	std::lock_guard<std::mutex> lock(mutex_);
+	stopping_ = true;
+      }
+
+      ready_.notify_one();
+      thread_.join();
+    }
+
+    bool closed = fclose(file_) == 0;
+    file_ = NULL;
+
+    if (failed_ || !closed) {
+      error = std::string("trace: ") + strerror(errno);
+      return false;
+    }
+
+    return true;
+  }
+
+  // Records written so far
+  inline uint64_t getRecordCount(void) const {
+    return recordCount_;
+  }
+
+ private:
+
+  // A worker's buffers: it fills active while the writer drains spare
+  struct alignas(64) Stripe {
+    Stripe() : used(0), spareUsed(0), spareBusy(false) { }
+
+    std::vector<TraceRecord> active;
+    std::vector<TraceRecord> spare;
+    size_t used;
+    size_t spareUsed;
+    bool spareBusy;
+  };
+
+  // Hand stripe's active buffer to the writer, once it has finished with the spare
+  void submit(const uint32_t& stripe) {
+
+    Stripe& buffers = stripes_[stripe];
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (buffers.spareBusy) {
+      written_.wait(lock);
+    }
+
+    buffers.active.swap(buffers.spare);
+    buffers.spareUsed = buffers.used;
+    buffers.spareBusy = true;
+    buffers.used = 0;
+
+    queue_.push_back(stripe);
+    lock.unlock();
+    ready_.notify_one();
+  }
+
+  void loop(void) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+
+      while (queue_.empty() && !stopping_) {
+	ready_.wait(lock);
+      }
+
+      if (queue_.empty()) {
+	return;
+      }
+
+      Stripe& buffers = stripes_[queue_.front()];
+      queue_.pop_front();
+
+      // The spare buffer is the writer's until spareBusy is cleared
+      lock.unlock();
+
+      if (fwrite(buffers.spare.data(), sizeof(TraceRecord), buffers.spareUsed, file_) != buffers.spareUsed) {
+	failed_ = true;
+      }
+
+      lock.lock();
+      recordCount_ += buffers.spareUsed;
+      buffers.spareBusy = false;
+      written_.notify_all();
+    }
+  }
+
+  size_t bufferRecords_;
+  std::vector<Stripe> stripes_;
+
+  FILE* file_;
+  bool failed_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable written_;
+  std::deque<uint32_t> queue_;
+  bool stopping_;
+  uint64_t recordCount_;
+};
+
+#endif // _TRACE_H_
@@ -0,0 +1,313 @@
+/*
+ * Worker.h
+ *
+ * Per-thread context through which a Client protocol sends messages and
+ * records statistics
+ *
+ * The population is split into contiguous, equally sized partitions of
+ * client ids, one per worker thread, and a worker only ever handles messages
+ * for and runs the tasks of clients in its own partition.  Messages sent from
+ * a worker are sorted into one outbox per destination partition.  At the end
+ * of a superstep flip() turns the outboxes into the pending messages that
+ * each partition's worker delivers in the next one, so no queue is written
+ * by one thread while another reads it.
+ *
+ * Messages are delivered in a canonical order that doesn't depend on the
+ * number of partitions: by recipient, then by sender, then in the order the
+ * sender sent them.  Workers handle their clients in id order, so each
+ * worker's outbox is already sorted by sender, and partitions cover ascending
+ * id ranges, so concatenating the outboxes in worker order sorts a
+ * partition's inbox by sender.  A stable radix sort by recipient does the
+ * rest.
+ *
+ * Messages over links with latency are held in the sending worker's
+ * CalendarQueue until the second they are due, when release() turns them
+ * into ordinary sends.  Released messages were sent at different times, so
+ * the superstep delivering them sorts by sender explicitly before sorting by
+ * recipient.
+ *
+ * Sends beyond the sender's outbound budget are suppressed here, before they
+ * are traced or reach the network.
+ */
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "ClientTypes.h"
+#include "GossipChain.h"
+#include "MessageQueue.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Latency.h"
+#include "CalendarQueue.h"
+#include "Bandwidth.h"
+
+class Worker {
+
+ public:
+  Worker(const uint32_t& index,
+	 const uint32_t& partitionCount,
+	 const uint32_t& partitionSize,
+	 ChainArena* chains,
+	 StatShard* stats,
+	 const LatencyModel* latency,
+	 Bandwidth* bandwidth)
+    : index_(index),
+      partitionSize_(partitionSize),
+      chains_(chains),
+      stats_(stats),
+      trace_(NULL),
+      latency_(latency),
+      bandwidth_(bandwidth),
+      now_(0),
+      outboxes_(partitionCount),
+      pending_(partitionCount),
+      inFlight_(partitionSize, (*latency).getHorizon()),
+      radixBits_(0),
+      senderBits_(0),
+      inboxAllocations_(0)
+  {
+    // Bits needed for an offset into the partition, and for any client id,
+    // rounded up to whole radix digits
+    while (radixBits_ < 32 && (partitionSize_ - 1) >> radixBits_ != 0) {
+      radixBits_ += 8;
+    }
+
+    while (senderBits_ < 32 && ((uint64_t)partitionCount * partitionSize_ - 1) >> senderBits_ != 0) {
+      senderBits_ += 8;
+    }
+  }
+
+  inline uint32_t getIndex(void) const {
+    return index_;
+  }
+
+  inline uint32_t getPartition(const clientId_t& clientId) const {
+    return clientId / partitionSize_;
+  }
+
+  inline void send(const ClientMessage& message) {
+    if (!(*bandwidth_).admitSend(message.senderId, now_)) {
+      (*stats_).incrementOutboundOverflows();
+      return;
+    }
+
+    (*this).trace(TRACE_SEND, message.messageType, message.timestamp, message.senderId, message.recipientId);
+
+    uint32_t latency = (*latency_)(message.senderId, message.recipientId);
+
+    if (latency == 0) {
+      outboxes_[getPartition(message.recipientId)].push(message);
+    } else {
+      inFlight_.push(now_ + latency, message);
+    }
+  }
+
+  // Simulated second that sends are made in
+  inline void setTime(const uint32_t& timestamp) {
+    now_ = timestamp;
+  }
+
+  inline uint32_t getTime(void) const {
+    return now_;
+  }
+
+  // Send the messages due now.  Returns how many there are.
+  inline size_t releaseDue(void) {
+    return inFlight_.release(now_, outboxes_);
+  }
+
+  // Hold message until deliveryTime.  Returns false if that is beyond the horizon.
+  bool hold(const uint32_t& deliveryTime, const ClientMessage& message) {
+    if (inFlight_.getHorizon() == 0 || deliveryTime < now_ || deliveryTime - now_ > inFlight_.getHorizon()) {
+      return false;
+    }
+
+    inFlight_.push(deliveryTime, message);
+    return true;
+  }
+
+  inline const CalendarQueue& getInFlight(void) const {
+    return inFlight_;
+  }
+
+  inline CalendarQueue& getInFlight(void) {
+    return inFlight_;
+  }
+
+  // First second after now with messages due, or CalendarQueue::NIL
+  inline uint32_t nextDelivery(void) const {
+    return inFlight_.next(now_);
+  }
+
+  // Record events in trace's stripe for this worker, or nowhere if trace is NULL
+  inline void setTrace(TraceWriter* trace) {
+    trace_ = trace;
+  }
+
+  inline void trace(const TraceEvent& event,
+		    const uint8_t& detail,
+		    const uint32_t& timestamp,
+		    const clientId_t& clientId,
+		    const clientId_t& peerId) {
+#ifndef SIMULATOR_NO_TRACE
+    if (trace_ != NULL) {
+      (*trace_).record(index_, event, detail, timestamp, clientId, peerId);
+    }
+#endif
+  }
+
+  // New gossip chain of clientId followed by parent, from this worker's stripe of the arena
+  inline chainId_t appendChain(const chainId_t& parent, const clientId_t& clientId) {
+    return (*chains_).append(index_, parent, clientId);
+  }
+
+  // This worker's share of the simulator's statistics
+  inline StatShard& getStats(void) {
+    return *stats_;
+  }
+
+  // Messages for partition sent from this worker before the last flip()
+  inline MessageQueue& getPending(const uint32_t& partition) {
+    return pending_[partition];
+  }
+
+  // Make the messages sent since the last flip pending.  Returns how many there are.
+  size_t flip(void) {
+    outboxes_.swap(pending_);
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < pending_.size(); i++) {
+      count += pending_[i].size();
+    }
+
+    return count;
+  }
+
+  // Move the messages pending for this worker's partition from every worker
+  // into the inbox, in delivery order.  Unless bySender is set, every
+  // worker's pending messages must already be in sender order.  Returns how
+  // many there are.
+  size_t collectInbox(const std::vector<Worker*>& workers, const bool& bySender = false) {
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < workers.size(); i++) {
+      count += (*workers[i]).pending_[index_].size();
+    }
+
+    if (count > inbox_.capacity()) {
+      inbox_.reserve(std::max(count, inbox_.capacity() * 2));
+      order_.reserve(inbox_.capacity());
+      sorted_.reserve(inbox_.capacity());
+      inboxAllocations_ += 3;
+    }
+
+    inbox_.clear();
+    order_.clear();
+
+    clientId_t partitionBegin = index_ * partitionSize_;
+
+    for (size_t i = 0; i < workers.size(); i++) {
+
+      MessageQueue& pending = (*workers[i]).pending_[index_];
+
+      for (; !pending.empty(); pending.pop()) {
+	order_.push_back((uint64_t)(pending.front().recipientId - partitionBegin) << 32 | inbox_.size());
+	inbox_.push_back(pending.front());
+      }
+    }
+
+    sorted_.resize(count);
+
+    // LSD radix sort on the sender, then stably on the recipient's offset, one byte at a time
+    for (uint32_t shift = 0; bySender && shift < senderBits_; shift += 8) {
+
+      uint32_t offsets[257] = { 0 };
+
+      for (size_t i = 0; i < count; i++) {
+	offsets[((inbox_[(uint32_t)order_[i]].senderId >> shift) & 0xFF) + 1]++;
+      }
+
+      for (uint32_t digit = 0; digit < 256; digit++) {
+	offsets[digit + 1] += offsets[digit];
+      }
+
+      for (size_t i = 0; i < count; i++) {
+	sorted_[offsets[(inbox_[(uint32_t)order_[i]].senderId >> shift) & 0xFF]++] = order_[i];
+      }
+
+      order_.swap(sorted_);
+    }
+
+    for (uint32_t shift = 32; shift < 32 + radixBits_; shift += 8) {
+
+      uint32_t offsets[257] = { 0 };
+
+      for (size_t i = 0; i < count; i++) {
+	offsets[((order_[i] >> shift) & 0xFF) + 1]++;
+      }
+
+      for (uint32_t digit = 0; digit < 256; digit++) {
+	offsets[digit + 1] += offsets[digit];
+      }
+
+      for (size_t i = 0; i < count; i++) {
+	sorted_[offsets[(order_[i] >> shift) & 0xFF]++] = order_[i];
+      }
+
+      order_.swap(sorted_);
+    }
+
+    return count;
+  }
+
+  // The index'th message to deliver since the last collectInbox()
+  inline const ClientMessage& getInboxMessage(const size_t& index) const {
+    return inbox_[(uint32_t)order_[index]];
+  }
+
+  // Heap allocations made by this worker's queues
+  size_t getAllocationCount(void) const {
+    size_t count = inboxAllocations_ + inFlight_.getAllocationCount();
+
+    for (size_t i = 0; i < outboxes_.size(); i++) {
+      count += outboxes_[i].getAllocationCount() + pending_[i].getAllocationCount();
+    }
+
+    return count;
+  }
+
+ private:
+  uint32_t index_;
+  uint32_t partitionSize_;
+
+  ChainArena* chains_;
+  StatShard* stats_;
+  TraceWriter* trace_;
+  const LatencyModel* latency_;
+  Bandwidth* bandwidth_;
+  uint32_t now_;
+
+  // Indexed by destination partition
+  std::vector<MessageQueue> outboxes_;
+  std::vector<MessageQueue> pending_;
+
+  // Messages sent over links with latency, by delivery time
+  CalendarQueue inFlight_;
+
+  // Messages for this worker's partition, and their delivery order as
+  // (recipient's offset into the partition << 32 | index into inbox_)
+  std::vector<ClientMessage> inbox_;
+  std::vector<uint64_t> order_;
+  std::vector<uint64_t> sorted_;
+  uint32_t radixBits_;
+  uint32_t senderBits_;
+  size_t inboxAllocations_;
+};
+
+#endif // _WORKER_H_
@@ -0,0 +1,127 @@
+/*
+ * WorkerPool.h
+ *
+ * Persistent threads that run one bulk-synchronous step at a time
+ *
+ * run() hands the same task to every worker, with the calling thread acting
+ * as worker 0, and returns once all of them have finished, so consecutive
+ * calls are separated by a barrier.  A pool of one thread runs the task
+ * inline and never starts a thread.
+ */
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "ClientTypes.h"
+
+class WorkerPool {
+
+ public:
+  typedef std::function<void(const uint32_t&)> Task;
+
+  WorkerPool(const uint32_t& threadCount)
+    : threadCount_(threadCount),
+      task_(NULL),
+      generation_(0),
+      remaining_(0),
+      stopping_(false)
+  {
+    for (uint32_t i = 1; i < threadCount_; i++) {
+      threads_.push_back(std::thread(&WorkerPool::loop, this, i));
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+
+    start_.notify_all();
+
+    for (size_t i = 0; i < threads_.size(); i++) {
+      threads_[i].join();
+    }
+  }
+
+  inline uint32_t getThreadCount(void) const {
+    return threadCount_;
+  }
+
+  // Run task(worker) for every worker and wait for all of them to finish
+  void run(const Task& task) {
+
+    if (threadCount_ == 1) {
+      task(0);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &task;
+      remaining_ = threadCount_ - 1;
+      generation_++;
+    }
+
+    start_.notify_all();
+    task(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return remaining_ == 0; });
+    task_ = NULL;
+  }
+
+ private:
+
+  void loop(const uint32_t index) {
+
+    uint64_t generation = 0;
+
+    while (true) {
+
+      const Task* task;
+
+      {
+	std::unique_lock<std::mutex> lock(mutex_);
+	start_.wait(lock, [this, generation]() { return stopping_ || generation_ != generation; });
+
+	if (stopping_) {
+	  return;
+	}
+
+	generation = generation_;
+	task = task_;
+      }
+
+      (*task)(index);
+
+      {
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (--remaining_ == 0) {
+	  done_.notify_one();
+	}
+      }
+    }
+  }
+
+  uint32_t threadCount_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+
+  const Task* task_;
+  uint64_t generation_;
+  uint32_t remaining_;
+  bool stopping_;
+};
+
+#endif // _WORKER_POOL_H_
@@ -0,0 +1,105 @@
+/*
+ * random_bench.cpp
+ *
+ * Microbenchmarks comparing the per-client CounterRandom streams against the
+ * libc generators they replaced: the global rand(), and rand_r() with one
+ * state per thread.  Draws are spread over clients the way the simulator
+ * makes them, in id order and in random order.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <ctime>
+
+#include "../CounterRandom.h"
+
+static double now(void) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char* generator, const char* pattern, const double& seconds, const size_t& operations) {
+  std::cout << std::left << std::setw(24) << generator
+	    << std::setw(16) << pattern
+	    << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+	    << seconds * 1e9 / operations << " ns/op" << std::endl;
+}
+
+// One draw per entry of clients, from that client's stream
+static void benchCounterRandom(const char* pattern, const std::vector<uint32_t>& clients, const uint32_t& rounds) {
+
+  CounterRandom random(1);
+  std::vector<uint32_t> counters(clients.size(), 0);
+  volatile uint32_t sink = 0;
+
+  double start = now();
+
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      sink += random(clients[i], counters[clients[i]]++);
+    }
+  }
+
+  report("CounterRandom", pattern, now() - start, clients.size() * rounds);
+}
+
+static void benchRand(const std::vector<uint32_t>& clients, const uint32_t& rounds) {
+
+  volatile uint32_t sink = 0;
+  srand(1);
+
+  double start = now();
+
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      sink += rand();
+    }
+  }
+
+  report("rand()", "any", now() - start, clients.size() * rounds);
+}
+
+static void benchRandR(const std::vector<uint32_t>& clients, const uint32_t& rounds) {
+
+  volatile uint32_t sink = 0;
+  unsigned int seed = 1;
+
+  double start = now();
+
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      sink += rand_r(&seed);
+    }
+  }
+
+  report("rand_r()", "any", now() - start, clients.size() * rounds);
+}
+
+int main(int argc, char* argv[]) {
+
+  const uint32_t clientCount = 1 << 20;
+  const uint32_t rounds = 10;
+
+  std::vector<uint32_t> ordered(clientCount);
+  std::vector<uint32_t> shuffled(clientCount);
+
+  for (uint32_t i = 0; i < clientCount; i++) {
+    ordered[i] = i;
+  }
+
+  shuffled = ordered;
+  srand(1);
+
+  for (uint32_t i = clientCount - 1; i > 0; i--) {
+    std::swap(shuffled[i], shuffled[rand() % (i + 1)]);
+  }
+
+  std::cout << "Random draws (" << clientCount << " clients)" << std::endl;
+  benchRand(ordered, rounds);
+  benchRandR(ordered, rounds);
+  benchCounterRandom("clients in order", ordered, rounds);
+  benchCounterRandom("clients shuffled", shuffled, rounds);
+}
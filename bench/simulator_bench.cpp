@@ -0,0 +1,375 @@
+/*
+ * simulator_bench.cpp
+ *
+ * Benchmarks of the simulator's hot paths, reported as JSON so runs can be
+ * compared by script: buddy graph generation in initialize(), message
+ * dispatch, GossipClient::handleMessage, HeartbeatClient::runTasks, and one
+ * simulated day of each protocol.  Gossip rounds over a large population
+ * (a million clients by default) are also delivered both a message at a
+ * time and in per-recipient batches, on uniform and power-law graphs, to
+ * measure what batching gains.
+ *
+ *   simulator_bench [--nodes <count>] [--threads <count>] [--seed <seed>] [--dispatch-nodes <count>]
+ *
+ * Everything the simulators print is discarded.  Each result names what it
+ * measured, the population it ran over, its wall time and operation count,
+ * and for whole runs the simulated seconds per wall second, counting the
+ * convergence run() simulates after the day as well as the day.  Heartbeat
+ * dispatches after every client's tasks, so its day runs over a tenth of the
+ * population to keep the suite short.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "../ClientSimulator.h"
+#include "../Client.h"
+
+static double now(void) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Throw away every message sent from worker, without delivering it
+static void discardMessages(Worker& worker, const uint32_t& partitionCount) {
+  worker.flip();
+
+  for (uint32_t i = 0; i < partitionCount; i++) {
+    MessageQueue& pending = worker.getPending(i);
+
+    while (!pending.empty()) {
+      pending.pop();
+    }
+  }
+}
+
+/*
+ * Simulators with their protected internals opened up to the benchmarks.
+ * The per-call benchmarks drive worker 0, so they run on the calling thread
+ * whatever the thread count.
+ */
+class GossipBench : public GossipSimulator {
+
+ public:
+  GossipBench(const SimulatorConfig& config)
+    : GossipSimulator(config) { }
+
+  // Wall time spent delivering "rounds" gossip rounds, not counting the
+  // clients starting them.  messages is set to the number delivered.
+  double benchDispatch(const uint32_t& rounds, uint64_t& messages) {
+
+    uint64_t before = (*stats_).getTotalMessagesSentCount();
+    double elapsed = 0;
+
+    for (uint32_t round = 0; round < rounds; round++) {
+
+      uint32_t timestamp = round * 60;
+
+      for (clientId_t i = 0; i < nodeCount_; i++) {
+	if (table_.isOnline(i)) {
+	  (*clients_).runTasks(i, timestamp, *workers_[getPartition(i)]);
+	}
+      }
+
+      double start = now();
+      (*this).dispatchPendingMessages();
+      elapsed += now() - start;
+    }
+
+    messages = (*stats_).getTotalMessagesSentCount() - before;
+    return elapsed;
+  }
+
+  // Wall time spent handling "batches" batches of one gossip message for
+  // every client.  messages is set to the number handled.
+  double benchHandleMessage(const uint32_t& batches, uint64_t& messages) {
+
+    Worker& worker = *workers_[0];
+    std::vector<ClientMessage> batch(nodeCount_);
+    double elapsed = 0;
+
+    for (uint32_t round = 0; round < batches; round++) {
+
+      // Every client hears from its first buddy, in a fresh gossip cycle every other batch
+      for (clientId_t i = 0; i < nodeCount_; i++) {
+
+	const BuddyGraph& graph = table_.getGraph();
+	clientId_t sender = graph.getBuddyCount(i) != 0 ? graph.getBuddy(graph.getBuddyBegin(i)) : i;
+
+	batch[i].recipientId = i;
+	batch[i].senderId = sender;
+	batch[i].timestamp = round / 2 * 60;
+	batch[i].messageType = GOSSIP;
+	batch[i].clientChain = worker.appendChain(NIL_CHAIN, sender);
+      }
+
+      double start = now();
+
+      for (clientId_t i = 0; i < nodeCount_; i++) {
+	(*clients_).handleMessage(batch[i], worker);
+      }
+
+      elapsed += now() - start;
+
+      discardMessages(worker, threadCount_);
+      (*chains_).reset();
+    }
+
+    messages = (uint64_t)batches * nodeCount_;
+    return elapsed;
+  }
+
+  // Wall time spent delivering "rounds" gossip rounds on the calling thread,
+  // in per-recipient batches or a message at a time.  Either way gives the
+  // same run.  messages is set to the number delivered.
+  double benchDelivery(const uint32_t& rounds, const bool& batched, uint64_t& messages) {
+
+    double elapsed = 0;
+    messages = 0;
+
+    for (uint32_t round = 0; round < rounds; round++) {
+
+      uint32_t timestamp = round * 60;
+
+      for (clientId_t i = 0; i < nodeCount_; i++) {
+	if (table_.isOnline(i)) {
+	  (*clients_).runTasks(i, timestamp, *workers_[getPartition(i)]);
+	}
+      }
+
+      double start = now();
+
+      while ((*this).exchangeMessages() != 0) {
+	for (uint32_t partition = 0; partition < threadCount_; partition++) {
+
+	  Worker& worker = *workers_[partition];
+	  uint32_t count = worker.collectInbox(workers_);
+
+	  for (uint32_t begin = 0, end = 0; begin < count; begin = end) {
+
+	    clientId_t recipient = worker.getInboxMessage(begin).recipientId;
+
+	    for (end = begin + 1; end < count && worker.getInboxMessage(end).recipientId == recipient; end++) { }
+
+	    MessageBatch batch(worker, table_, bandwidth_, begin, end);
+
+	    if (batched) {
+	      (*clients_).handleMessages(batch, worker);
+	    } else {
+	      (*clients_).Client<GossipClient>::handleMessages(batch, worker);
+	    }
+	  }
+
+	  messages += count;
+	}
+      }
+
+      (*chains_).reset();
+      elapsed += now() - start;
+    }
+
+    return elapsed;
+  }
+
+  inline uint32_t getPartition(const clientId_t& clientId) const {
+    return clientId / partitionSize_;
+  }
+};
+
+class HeartbeatBench : public HeartbeatSimulator {
+
+ public:
+  HeartbeatBench(const SimulatorConfig& config)
+    : HeartbeatSimulator(config) { }
+
+  // Wall time spent running "rounds" rounds of every ONLINE client's tasks,
+  // 12 seconds apart.  calls is set to the number of runTasks calls.
+  double benchRunTasks(const uint32_t& rounds, uint64_t& calls) {
+
+    Worker& worker = *workers_[0];
+    double elapsed = 0;
+    calls = 0;
+
+    for (uint32_t round = 0; round < rounds; round++) {
+
+      uint32_t timestamp = (round + 1) * 12;
+      double start = now();
+
+      for (clientId_t i = 0; i < nodeCount_; i++) {
+	if (table_.isOnline(i)) {
+	  (*clients_).runTasks(i, timestamp, worker);
+	  calls++;
+	}
+      }
+
+      elapsed += now() - start;
+      discardMessages(worker, threadCount_);
+    }
+
+    return elapsed;
+  }
+};
+
+/*
+ * class Report
+ *
+ * Collects results and prints them as one JSON document
+ */
+class Report {
+
+ public:
+  Report(const SimulatorConfig& config)
+    : config_(config)
+  { }
+
+  void add(const std::string& name, const uint32_t& nodeCount, const double& seconds, const uint64_t& operations,
+	   const std::string& unit, const double& simulatedSeconds = 0) {
+
+    std::ostringstream result;
+    result << std::fixed << std::setprecision(6)
+	   << "    {\"name\": \"" << name << "\", \"nodes\": " << nodeCount << ", \"wall_seconds\": " << seconds
+	   << ", \"operations\": " << operations << ", \"unit\": \"" << unit << "\""
+	   << std::setprecision(1)
+	   << ", \"operations_per_second\": " << (seconds > 0 ? operations / seconds : 0.0)
+	   << ", \"ns_per_operation\": " << (operations > 0 ? seconds * 1e9 / operations : 0.0);
+
+    if (simulatedSeconds > 0) {
+      result << ", \"simulated_seconds_per_second\": " << simulatedSeconds / seconds;
+    }
+
+    result << "}";
+    results_.push_back(result.str());
+  }
+
+  void print(std::ostream& out) const {
+    out << "{" << std::endl
+	<< "  \"buddies\": " << config_.buddyCount << "," << std::endl
+	<< "  \"threads\": " << config_.threadCount << "," << std::endl
+	<< "  \"seed\": " << config_.seed << "," << std::endl
+	<< "  \"results\": [" << std::endl;
+
+    for (size_t i = 0; i < results_.size(); i++) {
+      out << results_[i] << (i + 1 < results_.size() ? "," : "") << std::endl;
+    }
+
+    out << "  ]" << std::endl << "}" << std::endl;
+  }
+
+ private:
+  SimulatorConfig config_;
+  std::vector<std::string> results_;
+};
+
+int main(int argc, char* argv[]) {
+
+  SimulatorConfig config;
+  config.nodeCount = 10000;
+  config.seed = 1;
+  uint32_t dispatchNodes = 1000000;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      config.nodeCount = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      config.threadCount = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      config.seed = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--dispatch-nodes") == 0 && i + 1 < argc) {
+      dispatchNodes = strtoul(argv[++i], NULL, 10);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--nodes <count>] [--threads <count>] [--seed <seed>] [--dispatch-nodes <count>]" << std::endl;
+      return 1;
+    }
+  }
+
+  if (config.threadCount == 0 || config.buddyCount >= config.nodeCount || config.buddyCount >= dispatchNodes) {
+    std::cerr << "Need at least one thread and more nodes than buddies" << std::endl;
+    return 1;
+  }
+
+  // Silence the simulators, and report on the real stdout
+  std::ostream out(std::cout.rdbuf());
+  std::cout.rdbuf(NULL);
+
+  Report report(config);
+  uint64_t operations = 0;
+  const uint32_t day = 60 * 60 * 24;
+
+  {
+    double start = now();
+    GossipBench simulator(config);
+    double elapsed = now() - start;
+
+    report.add("initialize", config.nodeCount, elapsed, simulator.getGraph().getEdgeCount(), "buddy edges");
+
+    elapsed = simulator.benchDispatch(60, operations);
+    report.add("dispatchPendingMessages", config.nodeCount, elapsed, operations, "messages");
+
+    elapsed = simulator.benchHandleMessage(20, operations);
+    report.add("GossipClient::handleMessage", config.nodeCount, elapsed, operations, "messages");
+  }
+
+  // Each mode on its own simulator from the same seed, so both deliver the
+  // same rounds.  Batches only grow past a message or two where fan-in is
+  // concentrated, so both a uniform and a power-law graph are measured.
+  for (int topology = 0; topology < 2; topology++) {
+    for (int batched = 0; batched < 2; batched++) {
+      SimulatorConfig large = config;
+      large.nodeCount = dispatchNodes;
+      large.topology = topology == 0 ? UNIFORM : POWER_LAW;
+
+      GossipBench simulator(large);
+      double elapsed = simulator.benchDelivery(5, batched, operations);
+
+      std::string name = std::string(batched ? "batched delivery" : "message-at-a-time delivery")
+	+ (topology == 0 ? ", uniform" : ", powerlaw");
+      report.add(name, large.nodeCount, elapsed, operations, "messages");
+    }
+  }
+
+  {
+    SimulatorConfig heartbeat = config;
+    heartbeat.buddyCount = 10;
+
+    HeartbeatBench simulator(heartbeat);
+    double elapsed = simulator.benchRunTasks(50, operations);
+    report.add("HeartbeatClient::runTasks", heartbeat.nodeCount, elapsed, operations, "calls");
+  }
+
+  {
+    SimulatorConfig gossip = config;
+    gossip.timespan = day;
+
+    GossipSimulator simulator(gossip);
+
+    // run() goes on past the day until the buddy tables converge
+    uint32_t simulated = day + GossipSimulator::CONVERGENCE_SPAN;
+
+    double start = now();
+    simulator.run();
+    report.add("gossip day", gossip.nodeCount, now() - start, simulated, "simulated seconds", simulated);
+  }
+
+  {
+    SimulatorConfig heartbeat = config;
+    heartbeat.nodeCount = std::max(config.nodeCount / 10, (uint32_t)11);
+    heartbeat.buddyCount = 10;
+    heartbeat.timespan = day;
+
+    HeartbeatSimulator simulator(heartbeat);
+    uint32_t simulated = day + HeartbeatSimulator::CONVERGENCE_SPAN;
+
+    double start = now();
+    simulator.run();
+    report.add("heartbeat day", heartbeat.nodeCount, now() - start, simulated, "simulated seconds", simulated);
+  }
+
+  report.print(out);
+}
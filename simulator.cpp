@@ -1,16 +1,284 @@
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include "ClientSimulator.h"
 #include "Client.h"
+#include "GraphFile.h"
+#include "Checkpoint.h"
+#include "Trace.h"
+#include "Churn.h"
+#include "Latency.h"
 
-int main(int argc, char* argv[], char* envp[]) {
-  // Run the simulator for our "heartbeat" protocol
-  //HeartbeatSimulator<1000, 10, 60*60> simulator;
-  //simulator.run();
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [gossip|heartbeat] [options]" << std::endl;
+  std::cerr << "  --nodes <count>       Number of simulated clients" << std::endl;
+  std::cerr << "  --buddies <count>     Buddies per client" << std::endl;
+  std::cerr << "  --timespan <seconds>  Simulated time before the consistency check" << std::endl;
+  std::cerr << "  --threads <count>     Worker threads to partition the clients across" << std::endl;
+  std::cerr << "  --seed <seed>         Random seed, for reproducible runs (default: the time)" << std::endl;
+  std::cerr << "  --topology <type>     Buddy graph: uniform, powerlaw, smallworld or community" << std::endl;
+  std::cerr << "  --graph <file>        Map the buddy graph from a graph file instead of generating it" << std::endl;
+  std::cerr << "  --write-graph <file>  Write the buddy graph to a graph file before running" << std::endl;
+  std::cerr << "  --checkpoint <file>   Checkpoint the run to a file when the timespan is reached" << std::endl;
+  std::cerr << "  --checkpoint-every <seconds>  Also checkpoint at every multiple of this many seconds" << std::endl;
+  std::cerr << "  --restore <file>      Continue a checkpointed run, up to --timespan if given" << std::endl;
+  std::cerr << "  --trace <file>        Record every message and state switch to a binary trace" << std::endl;
+  std::cerr << "  --churn <file>        Replay recorded online/offline events instead of random sleeps" << std::endl;
+  std::cerr << "  --latency <model>     Link latency: none, constant:<s>, uniform:<min>:<max> or exponential:<mean>" << std::endl;
+  std::cerr << "  --inbound <count>     Messages a client can handle per second (default: unlimited)" << std::endl;
+  std::cerr << "  --outbound <count>    Messages a client can send per second (default: unlimited)" << std::endl;
+  std::cerr << "  --queue <count>       Messages that can wait in a client's receive queue (default: 0)" << std::endl;
+  std::cerr << "  --drop <policy>       Full receive queues drop by tail (the default) or red (random early drop)" << std::endl;
+}
+
+// Write out the simulator's graph and restore its checkpoint, if asked to, then run it
+template<class Simulator>
+int simulate(Simulator& simulator, const char* writeGraphPath, CheckpointReader* checkpoint) {
+
+  std::string error;
 
+  if (writeGraphPath != NULL && !GraphFile::write(simulator.getGraph(), writeGraphPath, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  if (checkpoint != NULL && !simulator.restore(*checkpoint, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
 
-  // Run the simulator for our "gossip" protocol
-  GossipSimulator<1000, 20, 60*60*24*30*3> simulator;
   simulator.run();
+  return 0;
 }
 
+int main(int argc, char* argv[], char* envp[]) {
+
+  SimulatorConfig config;
+  config.seed = time(NULL);
+  bool heartbeat = false;
+  bool buddiesSet = false;
+  bool timespanSet = false;
+  bool queueSet = false;
+  const char* graphPath = NULL;
+  const char* writeGraphPath = NULL;
+  const char* restorePath = NULL;
+  const char* tracePath = NULL;
+  const char* churnPath = NULL;
+  LatencyModel latency;
+
+  for (int i = 1; i < argc; i++) {
+
+    if (strcmp(argv[i], "gossip") == 0) {
+      heartbeat = false;
+    } else if (strcmp(argv[i], "heartbeat") == 0) {
+      heartbeat = true;
+    } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      config.nodeCount = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--buddies") == 0 && i + 1 < argc) {
+      config.buddyCount = strtoul(argv[++i], NULL, 10);
+      buddiesSet = true;
+    } else if (strcmp(argv[i], "--timespan") == 0 && i + 1 < argc) {
+      config.timespan = strtoul(argv[++i], NULL, 10);
+      timespanSet = true;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      config.threadCount = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      config.seed = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--topology") == 0 && i + 1 < argc) {
+
+      const char* topology = argv[++i];
+
+      if (strcmp(topology, "uniform") == 0) {
+	config.topology = UNIFORM;
+      } else if (strcmp(topology, "powerlaw") == 0) {
+	config.topology = POWER_LAW;
+      } else if (strcmp(topology, "smallworld") == 0) {
+	config.topology = SMALL_WORLD;
+      } else if (strcmp(topology, "community") == 0) {
+	config.topology = COMMUNITY;
+      } else {
+	usage(argv[0]);
+	return 1;
+      }
+    } else if (strcmp(argv[i], "--graph") == 0 && i + 1 < argc) {
+      graphPath = argv[++i];
+    } else if (strcmp(argv[i], "--write-graph") == 0 && i + 1 < argc) {
+      writeGraphPath = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      config.checkpointPath = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+      config.checkpointInterval = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restorePath = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc) {
+      churnPath = argv[++i];
+    } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+
+      std::string error;
+
+      if (!LatencyModel::parse(argv[++i], latency, error)) {
+	std::cerr << error << std::endl;
+	return 1;
+      }
+
+      config.latency = &latency;
+    } else if (strcmp(argv[i], "--inbound") == 0 && i + 1 < argc) {
+      config.inboundBudget = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--outbound") == 0 && i + 1 < argc) {
+      config.outboundBudget = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+      config.queueCapacity = strtoul(argv[++i], NULL, 10);
+      queueSet = true;
+    } else if (strcmp(argv[i], "--drop") == 0 && i + 1 < argc) {
+
+      const char* policy = argv[++i];
+      queueSet = true;
+
+      if (strcmp(policy, "tail") == 0) {
+	config.dropPolicy = TAIL_DROP;
+      } else if (strcmp(policy, "red") == 0) {
+	config.dropPolicy = RANDOM_EARLY_DROP;
+      } else {
+	usage(argv[0]);
+	return 1;
+      }
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // A checkpoint fixes the protocol, the population and the seed, and by
+  // default the timespan
+  CheckpointReader checkpoint;
+
+  if (restorePath != NULL) {
+
+    std::string error;
+
+    if (!checkpoint.open(restorePath, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+
+    const CheckpointHeader& header = checkpoint.getHeader();
+    heartbeat = header.protocol == HEARTBEAT_PROTOCOL;
+    config.nodeCount = header.nodeCount;
+    config.buddyCount = header.buddyCount;
+    config.topology = (TopologyType)header.topology;
+    config.seed = header.seed;
+    buddiesSet = true;
+
+    if (!timespanSet) {
+      config.timespan = header.timespan;
+      timespanSet = true;
+    }
+  }
+
+  // The heartbeat protocol has its own defaults, which the checks below must see
+  if (heartbeat) {
+
+    if (!buddiesSet) {
+      config.buddyCount = 10;
+    }
+
+    if (!timespanSet) {
+      config.timespan = 60*60;
+    }
+  }
 
+  // A mapped graph fixes the population size
+  GraphFile graph;
+
+  if (graphPath != NULL) {
+
+    std::string error;
+
+    if (!graph.map(graphPath, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+
+    config.nodeCount = graph.getNodeCount();
+    config.graph = &graph;
+  }
+
+  if (config.graph == NULL && config.buddyCount >= config.nodeCount) {
+    std::cerr << "--buddies must be smaller than --nodes" << std::endl;
+    return 1;
+  }
+
+  if (config.threadCount == 0) {
+    std::cerr << "--threads must be at least 1" << std::endl;
+    return 1;
+  }
+
+  // Only clients with an inbound budget have a receive queue
+  if (queueSet && config.inboundBudget == 0) {
+    std::cerr << "--queue and --drop need --inbound" << std::endl;
+    return 1;
+  }
+
+  // Messages carry 30 bit timestamps, with room left for convergence and latency
+  if (config.timespan > MAX_MESSAGE_TIMESTAMP - 2*60*60*24) {
+    std::cerr << "--timespan must be at most " << MAX_MESSAGE_TIMESTAMP - 2*60*60*24 << " seconds" << std::endl;
+    return 1;
+  }
+
+  // The trace outlives the simulator, so every record is written when it closes
+  TraceWriter trace(config.threadCount);
+
+  if (tracePath != NULL) {
+
+#ifdef SIMULATOR_NO_TRACE
+    std::cerr << "--trace is not available: tracing was compiled out" << std::endl;
+    return 1;
+#endif
+
+    // Trace records carry 28 bit times, with the same room left for convergence and latency
+    if (config.timespan > MAX_TRACE_TIME - 2*60*60*24) {
+      std::cerr << "--trace needs a --timespan of at most " << MAX_TRACE_TIME - 2*60*60*24 << " seconds" << std::endl;
+      return 1;
+    }
+
+    std::string error;
+
+    if (!trace.open(tracePath, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+
+    config.trace = &trace;
+  }
+
+  // Churn is streamed from the file as the run reaches it
+  ChurnReader churn;
+
+  if (churnPath != NULL) {
+
+    std::string error;
+
+    if (!churn.open(churnPath, config.nodeCount, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+
+    config.churn = &churn;
+  }
+
+  if (heartbeat) {
+
+    // Run the simulator for our "heartbeat" protocol
+    HeartbeatSimulator simulator(config);
+    return simulate(simulator, writeGraphPath, restorePath != NULL ? &checkpoint : NULL);
+
+  } else {
+
+    // Run the simulator for our "gossip" protocol
+    GossipSimulator simulator(config);
+    return simulate(simulator, writeGraphPath, restorePath != NULL ? &checkpoint : NULL);
+  }
+}
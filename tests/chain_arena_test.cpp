@@ -0,0 +1,56 @@
+/*
+ * chain_arena_test.cpp
+ *
+ * Checks that the gossip chain arena stays bounded over long runs with link
+ * latency, where some message is always in flight and the arena can never
+ * simply be reset.  A run ten times longer must not need a larger arena
+ * than twice the shorter run's.
+ */
+
+#include <iostream>
+
+#include "../ClientSimulator.h"
+#include "../Client.h"
+
+// Chain arena capacity, in nodes, after a gossip run of "days" simulated days
+static size_t arenaCapacity(const uint32_t& days, const LatencyModel& latency) {
+
+  SimulatorConfig config;
+  config.nodeCount = 500;
+  config.seed = 1;
+  config.timespan = days * 60 * 60 * 24;
+  config.latency = &latency;
+
+  GossipSimulator simulator(config);
+  simulator.run();
+
+  return (*simulator.chains_).getCapacity();
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string error;
+  LatencyModel latency;
+
+  if (!LatencyModel::parse("constant:60", latency, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  // Silence the simulators
+  std::ostream out(std::cout.rdbuf());
+  std::cout.rdbuf(NULL);
+
+  size_t shortRun = arenaCapacity(2, latency);
+  size_t longRun = arenaCapacity(20, latency);
+
+  out << "chain arena capacity: " << shortRun << " nodes after 2 days, " << longRun << " after 20" << std::endl;
+
+  if (longRun > shortRun * 2) {
+    out << "FAIL: chain arena grows with the length of the run" << std::endl;
+    return 1;
+  }
+
+  out << "PASS" << std::endl;
+  return 0;
+}
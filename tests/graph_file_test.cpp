@@ -0,0 +1,120 @@
+/*
+ * graph_file_test.cpp
+ *
+ * Checks that GraphFile::map() refuses graph files whose arrays are in range
+ * but are not a graph freeze() could have built: buddy lists that are
+ * unsorted, repeat a buddy or hold the client itself, and observer indexes
+ * that are not the transpose of the buddy lists.  Running on any of these
+ * can hang a protocol or break findBuddy().
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "../GraphFile.h"
+
+static const char* PATH = "tests/graph_file_test.graph";
+
+// Write a graph file with the given CSR arrays, laid out as GraphFile::write() does
+static bool writeGraph(const std::vector<uint32_t>& buddyOffsets, const std::vector<clientId_t>& buddies,
+		       const std::vector<uint32_t>& observerOffsets, const std::vector<clientId_t>& observers) {
+
+  GraphFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic));
+  header.version = GRAPH_FILE_VERSION;
+  header.byteOrder = GRAPH_FILE_BYTE_ORDER;
+  header.nodeCount = buddyOffsets.size() - 1;
+  header.edgeCount = buddies.size();
+  header.buddyOffsets = 64;
+  header.buddies = header.buddyOffsets + 64;
+  header.observerOffsets = header.buddies + 64;
+  header.observers = header.observerOffsets + 64;
+  header.fileSize = header.observers + observers.size() * sizeof(clientId_t);
+
+  std::vector<char> data(header.fileSize, 0);
+  memcpy(&data[0], &header, sizeof(header));
+  memcpy(&data[header.buddyOffsets], buddyOffsets.data(), buddyOffsets.size() * sizeof(uint32_t));
+  memcpy(&data[header.buddies], buddies.data(), buddies.size() * sizeof(clientId_t));
+  memcpy(&data[header.observerOffsets], observerOffsets.data(), observerOffsets.size() * sizeof(uint32_t));
+  memcpy(&data[header.observers], observers.data(), observers.size() * sizeof(clientId_t));
+
+  std::ofstream file(PATH, std::ios::binary);
+  file.write(&data[0], data.size());
+  return file.good();
+}
+
+// Whether a file with these arrays maps as expected, reporting if not
+static bool check(const std::string& name, const bool& valid,
+		  const std::vector<uint32_t>& buddyOffsets, const std::vector<clientId_t>& buddies,
+		  const std::vector<uint32_t>& observerOffsets, const std::vector<clientId_t>& observers) {
+
+  if (!writeGraph(buddyOffsets, buddies, observerOffsets, observers)) {
+    std::cout << "FAIL: " << name << ": could not write " << PATH << std::endl;
+    return false;
+  }
+
+  GraphFile graph;
+  std::string error;
+  bool mapped = graph.map(PATH, error);
+
+  if (mapped != valid) {
+    std::cout << "FAIL: " << name << (valid ? " was refused: " + error : " was accepted") << std::endl;
+    return false;
+  }
+
+  std::cout << name << ": " << (mapped ? "accepted" : error) << std::endl;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+
+  typedef std::vector<uint32_t> Offsets;
+  typedef std::vector<clientId_t> Ids;
+
+  bool passed = true;
+
+  // 0 -> {1, 2}, 1 -> {2}, 2 -> {0}
+  passed &= check("valid graph", true,
+		  Offsets{0, 2, 3, 4}, Ids{1, 2, 2, 0},
+		  Offsets{0, 1, 2, 4}, Ids{2, 0, 0, 1});
+
+  // Each client its own only buddy
+  passed &= check("self edges", false,
+		  Offsets{0, 1, 2}, Ids{0, 1},
+		  Offsets{0, 1, 2}, Ids{0, 1});
+
+  passed &= check("unsorted buddy list", false,
+		  Offsets{0, 2, 3, 4}, Ids{2, 1, 2, 0},
+		  Offsets{0, 1, 2, 4}, Ids{2, 0, 0, 1});
+
+  passed &= check("repeated buddy", false,
+		  Offsets{0, 2, 3, 4}, Ids{1, 1, 2, 0},
+		  Offsets{0, 1, 3, 4}, Ids{2, 0, 0, 1});
+
+  passed &= check("buddy out of range", false,
+		  Offsets{0, 2, 3, 4}, Ids{1, 3, 2, 0},
+		  Offsets{0, 1, 2, 4}, Ids{2, 0, 0, 1});
+
+  // Right observer counts, wrong observers
+  passed &= check("observers not the transpose", false,
+		  Offsets{0, 2, 3, 4}, Ids{1, 2, 2, 0},
+		  Offsets{0, 1, 2, 4}, Ids{2, 2, 0, 1});
+
+  // Right observers, wrong split between clients
+  passed &= check("observer counts not the in-degrees", false,
+		  Offsets{0, 2, 3, 4}, Ids{1, 2, 2, 0},
+		  Offsets{0, 2, 2, 4}, Ids{1, 2, 0, 1});
+
+  remove(PATH);
+
+  if (!passed) {
+    return 1;
+  }
+
+  std::cout << "PASS" << std::endl;
+  return 0;
+}